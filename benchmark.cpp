@@ -0,0 +1,329 @@
+#include "main.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Struct workload.
+// Used for describing the generator of the queries.
+struct workload {
+public:
+    // Field std::string name - name of the workload in the results.
+    std::string name;
+
+    // Field query (*generate)(...) - function that creates the query by its number.
+    query (*generate)(const int size, const int index, std::uint64_t &state);
+};
+
+// Struct measurement.
+// Used for describing time of the benchmark phases in seconds.
+struct measurement {
+public:
+    // Field double read - time of reading the input with read_data.
+    double read;
+
+    // Field double build - time of creating the treap.
+    double build;
+
+    // Field double apply - time of processing all queries with reorder.
+    double apply;
+
+    // Field double extract - time of get_elements.
+    double extract;
+
+    // Field double write - time of writing the output with write_data.
+    double write;
+
+    // Field unsigned long long checksum - hash of the resulting array.
+    unsigned long long checksum;
+};
+
+// Struct compact_treap.
+// Treap that is compacted in the order of the elements after every size changes,
+// so compaction adds O(1) amortized time per query.
+struct compact_treap : public treap {
+public:
+    // Initialization - create new treap with elements from 1 up to size.
+    explicit compact_treap(const int size) : treap(size) {
+        set_compact_period(size);
+    }
+};
+
+// Function next_random - generate next pseudo-random number (splitmix64).
+// Parameter std::uint64_t &state - state of the generator.
+// Return std::uint64_t - pseudo-random number.
+std::uint64_t next_random(std::uint64_t &state) {
+    std::uint64_t key = (state += 0x9e3779b97f4a7c15ULL);
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+// Function random_position - generate position in the array.
+// Parameter const int size - number of elements in the array.
+// Parameter std::uint64_t &state - state of the generator.
+// Return int - position from 1 up to size.
+int random_position(const int size, std::uint64_t &state) {
+    return static_cast<int>(next_random(state) % size) + 1;
+}
+
+// Function generate_uniform - subsegment with both ends chosen uniformly.
+query generate_uniform(const int size, const int, std::uint64_t &state) {
+    const int first = random_position(size, state);
+    const int second = random_position(size, state);
+    return first < second ? query(first, second) : query(second, first);
+}
+
+// Function generate_prefix - subsegment that starts at the first position.
+query generate_prefix(const int size, const int, std::uint64_t &state) {
+    return query(1, random_position(size, state));
+}
+
+// Function generate_suffix - subsegment that ends at the last position.
+query generate_suffix(const int size, const int, std::uint64_t &state) {
+    return query(random_position(size, state), size);
+}
+
+// Function generate_tiny - subsegment of at most 4 elements.
+query generate_tiny(const int size, const int, std::uint64_t &state) {
+    const int left = random_position(size, state);
+    const int right = left + static_cast<int>(next_random(state) % 4);
+    return query(left, right < size ? right : size);
+}
+
+// Function generate_full - the whole array, moved without any change.
+query generate_full(const int size, const int, std::uint64_t &) {
+    return query(1, size);
+}
+
+// Function generate_sorted - suffixes with left ends going in sorted order.
+// Each query moves the largest remaining values in front of the smallest ones,
+// which made the tree degenerate when values were used as priorities.
+query generate_sorted(const int size, const int index, std::uint64_t &) {
+    return query(size > 1 ? index % (size - 1) + 2 : 1, size);
+}
+
+// Function seconds_since - find time passed from the given moment.
+// Parameter const std::chrono::steady_clock::time_point start - the moment.
+// Return double - number of seconds.
+double seconds_since(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Function run - measure all phases of solving the generated input once.
+// Tree is treap, compact_treap, bplus_tree or flat_array,
+// all of them provide reorder and get_elements.
+// Parameter const workload &generator - workload of the queries.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter const std::uint64_t seed - seed of the queries.
+// Parameter const std::string &input_path - temporary file for the input.
+// Return measurement - time of the phases.
+template <typename Tree>
+measurement run(
+    const workload &generator,
+    const int size,
+    const int queries_count,
+    const std::uint64_t seed,
+    const std::string &input_path) {
+
+    {
+        std::ofstream input(input_path.c_str());
+        input << size << " " << queries_count << "\n";
+        std::uint64_t state = seed;
+        for (int i = 0; i < queries_count; ++i) {
+            const query current = generator.generate(size, i, state);
+            input << current.left_position << " " << current.right_position << "\n";
+        }
+    }
+
+    measurement result;
+    int read_size, read_queries_count;
+    std::vector<query> queries;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    {
+        input_reader reader(input_path);
+        read_data(reader, read_size, read_queries_count, queries);
+    }
+    result.read = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    Tree tree(size);
+    result.build = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < queries_count; ++i) {
+        tree.reorder(queries[i].left_position, queries[i].right_position);
+    }
+    result.apply = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    const std::vector<int> elements = tree.get_elements();
+    result.extract = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        std::ofstream output("/dev/null");
+        write_data(output, elements);
+    }
+    result.write = seconds_since(start);
+
+    result.checksum = 0;
+    for (std::size_t i = 0; i < elements.size(); ++i) {
+        result.checksum = result.checksum * 1000003ULL + elements[i];
+    }
+    return result;
+}
+
+// Function keep_best - keep the minimal time of every phase.
+// Parameter measurement &best - best measurement so far.
+// Parameter const measurement &current - new measurement.
+void keep_best(measurement &best, const measurement &current) {
+    best.read = current.read < best.read ? current.read : best.read;
+    best.build = current.build < best.build ? current.build : best.build;
+    best.apply = current.apply < best.apply ? current.apply : best.apply;
+    best.extract = current.extract < best.extract ? current.extract : best.extract;
+    best.write = current.write < best.write ? current.write : best.write;
+}
+
+// Function create_input_file - create new empty file for the input in the temporary directory,
+// so benchmarks that run at the same time do not overwrite the inputs of each other.
+// Return std::string - path of the file.
+// Throws std::runtime_error if the file can not be created.
+std::string create_input_file() {
+#ifdef _WIN32
+    char name[L_tmpnam];
+    if (!std::tmpnam(name)) {
+        throw std::runtime_error("cannot create temporary input file");
+    }
+    return name;
+#else
+    const char *directory = std::getenv("TMPDIR");
+    std::string path = directory && *directory ? directory : "/tmp";
+    path += "/benchmark_input.XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    const int descriptor = mkstemp(name.data());
+    if (descriptor < 0) {
+        throw std::runtime_error("cannot create temporary input file in " + path);
+    }
+    close(descriptor);
+    return name.data();
+#endif
+}
+
+// Main function of the benchmark.
+// Usage: benchmark [--size n] [--queries q] [--seed s] [--repeat r] [--workload name]...
+//        [--engine treap|compact|bplus|flat]...
+// Prints one JSON object per workload and engine with the best time of every phase in seconds.
+// Input of every run is written to a unique file in TMPDIR (/tmp by default), that is removed at the end.
+int main(int argc, char *argv[]) {
+    const workload workloads[] = {
+        { "uniform", generate_uniform },
+        { "prefix", generate_prefix },
+        { "suffix", generate_suffix },
+        { "tiny", generate_tiny },
+        { "full", generate_full },
+        { "sorted", generate_sorted },
+    };
+    const int workloads_count = sizeof(workloads) / sizeof(workloads[0]);
+
+    int size = 1000000;
+    int queries_count = 1000000;
+    std::uint64_t seed = 1;
+    int repeat = 3;
+    std::vector<std::string> selected;
+    std::vector<std::string> engines;
+    for (int i = 1; i < argc; i += 2) {
+        const std::string argument = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "argument " << argument << " needs a value" << std::endl;
+            return 1;
+        }
+        const std::string value = argv[i + 1];
+        if (argument == "--size") {
+            size = std::stoi(value);
+        } else if (argument == "--queries") {
+            queries_count = std::stoi(value);
+        } else if (argument == "--seed") {
+            seed = std::stoull(value);
+        } else if (argument == "--repeat") {
+            repeat = std::stoi(value);
+        } else if (argument == "--workload") {
+            selected.push_back(value);
+        } else if (argument == "--engine"
+            && (value == "treap" || value == "compact" || value == "bplus" || value == "flat")) {
+            engines.push_back(value);
+        } else {
+            std::cerr << "unknown argument " << argument << std::endl;
+            return 1;
+        }
+    }
+    if (size < 1 || queries_count < 0 || repeat < 1) {
+        std::cerr << "size and repeat must be positive" << std::endl;
+        return 1;
+    }
+
+    if (engines.empty()) {
+        engines.push_back("treap");
+        engines.push_back("bplus");
+    }
+
+    std::string input_path;
+    try {
+        input_path = create_input_file();
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    for (int i = 0; i < workloads_count; ++i) {
+        bool enabled = selected.empty();
+        for (std::size_t j = 0; j < selected.size(); ++j) {
+            enabled = enabled || selected[j] == workloads[i].name;
+        }
+        if (!enabled) {
+            continue;
+        }
+
+        for (std::size_t k = 0; k < engines.size(); ++k) {
+            measurement (*run_engine)(
+                const workload &,
+                const int,
+                const int,
+                const std::uint64_t,
+                const std::string &) = engines[k] == "treap"
+                    ? run<treap>
+                    : engines[k] == "compact"
+                        ? run<compact_treap>
+                        : engines[k] == "bplus" ? run<bplus_tree> : run<flat_array>;
+
+            measurement best = run_engine(workloads[i], size, queries_count, seed, input_path);
+            for (int j = 1; j < repeat; ++j) {
+                keep_best(best, run_engine(workloads[i], size, queries_count, seed, input_path));
+            }
+
+            std::ostringstream line;
+            line << "{\"workload\": \"" << workloads[i].name << "\""
+                << ", \"engine\": \"" << engines[k] << "\""
+                << ", \"size\": " << size
+                << ", \"queries\": " << queries_count
+                << ", \"seed\": " << seed
+                << ", \"read\": " << best.read
+                << ", \"build\": " << best.build
+                << ", \"apply\": " << best.apply
+                << ", \"extract\": " << best.extract
+                << ", \"write\": " << best.write
+                << ", \"checksum\": " << best.checksum << "}";
+            std::cout << line.str() << std::endl;
+        }
+    }
+    std::remove(input_path.c_str());
+
+    return 0;
+}
@@ -1,165 +1,339 @@
 #include "main.h"
 
-treap::treap(const int size) {
-    std::vector<int> values(size);
-    for (int i = 0; i < size; ++i) {
-        values[i] = i + 1;
-    }
-    root = build(1, size, values);
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <exception>
+#include <sstream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef TREAP_INSTRUMENTATION
+#include <mutex>
+#endif
+
+std::uint32_t hash_priority(std::uint64_t key) {
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return static_cast<std::uint32_t>((key ^ (key >> 31)) >> 33);
 }
 
-treap::treap(std::vector<int> &values) {
-    root = build(1, values.size(), values);
+#ifdef TREAP_INSTRUMENTATION
+// Struct instrumentation_total.
+// Counters of all finished threads, written to standard error at exit.
+struct instrumentation_total {
+public:
+    // Field treap_instrumentation counters - sum of the counters.
+    treap_instrumentation counters;
+
+    // Field std::mutex lock - guards counters.
+    std::mutex lock;
+
+    // Destruction - write the counters as JSON.
+    ~instrumentation_total() {
+        counters.write(std::cerr);
+    }
+};
+
+// Struct instrumentation_thread.
+// Counters of one thread that are added to the total when the thread exits.
+struct instrumentation_thread {
+public:
+    // Field treap_instrumentation counters - counters of the thread.
+    treap_instrumentation counters;
+
+    // Field instrumentation_total &total - where the counters are added.
+    instrumentation_total &total;
+
+    // Initialization with zero counters.
+    explicit instrumentation_thread(instrumentation_total &total) : total(total) {}
+
+    // Destruction - add the counters to the total.
+    ~instrumentation_thread() {
+        std::lock_guard<std::mutex> guard(total.lock);
+        total.counters.add(counters);
+    }
+};
+
+// Function latency_bucket - find bucket of the latency histogram.
+// Parameter unsigned long long nanoseconds - latency.
+// Return int - values below 8 have own buckets, every next power of two
+// is divided into 8 equal buckets.
+int latency_bucket(unsigned long long nanoseconds) {
+    if (nanoseconds < 8) {
+        return static_cast<int>(nanoseconds);
+    }
+    int exponent = 3;
+    while (nanoseconds >> (exponent + 1)) {
+        ++exponent;
+    }
+    return (exponent - 2) * 8 + static_cast<int>((nanoseconds >> (exponent - 3)) & 7);
 }
 
-void treap::reorder(const int left, const int right) {
-    root = reorder(root, left, right);
+// Function latency_bound - find the largest latency that goes to the bucket.
+// Parameter const int bucket - bucket of the latency histogram.
+// Return unsigned long long - latency in nanoseconds.
+unsigned long long latency_bound(const int bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    const int exponent = bucket / 8 + 2;
+    const unsigned long long lower = static_cast<unsigned long long>(8 + bucket % 8) << (exponent - 3);
+    return lower + (1ULL << (exponent - 3)) - 1;
 }
 
-std::string treap::get_description(const std::string separator) {
-    // return get_description(root);
+treap_instrumentation::treap_instrumentation()
+    : split_calls(0),
+    split_nodes(0),
+    split_depth(0),
+    merge_calls(0),
+    merge_nodes(0),
+    merge_depth(0),
+    reorder_calls(0),
+    max_latency(0),
+    fused_queries(0),
+    removed_queries(0) {
 
-    std::vector<int> elements = get_elements();
-    if (elements.size() == 0) {
-        return "";
-    }
-    std::string description = std::to_string(elements[0]);
-    for (int i = 1; i < elements.size(); ++i) {
-        description += separator + std::to_string(elements[i]);
+    for (int i = 0; i < histogram_size; ++i) {
+        latency[i] = 0;
     }
-    return description;
 }
 
-treap::node::node() : value(0) {}
-treap::node::node(const int value) : value(value) {}
+void treap_instrumentation::record_split(const int visited) {
+    ++split_calls;
+    split_nodes += visited;
+    split_depth = visited > split_depth ? visited : split_depth;
+}
 
-int treap::size(node *root) {
-    return root ? root->size : 0;
+void treap_instrumentation::record_merge(const int visited) {
+    ++merge_calls;
+    merge_nodes += visited;
+    merge_depth = visited > merge_depth ? visited : merge_depth;
 }
 
-void treap::update(node *root) {
-    if (!root) {
-        return;
-    }
-    root->size = 1 + size(root->left) + size(root->right);
+void treap_instrumentation::record_reorder(const unsigned long long nanoseconds) {
+    ++reorder_calls;
+    ++latency[latency_bucket(nanoseconds)];
+    max_latency = nanoseconds > max_latency ? nanoseconds : max_latency;
 }
 
-void treap::merge(node *left, node *right, node *&result) {
-    if (!left) {
-        result = right;
-    } else if (!right) {
-        result = left;
-    } else if (left->value > right->value) {
-        merge(left->right, right, left->right);
-        result = left;
-    } else {
-        merge(left, right->left, right->left);
-        result = right;
+void treap_instrumentation::record_fusion(const int queries_count, const int removed_count) {
+    fused_queries += queries_count;
+    removed_queries += removed_count;
+}
+
+void treap_instrumentation::add(const treap_instrumentation &other) {
+    split_calls += other.split_calls;
+    split_nodes += other.split_nodes;
+    split_depth = other.split_depth > split_depth ? other.split_depth : split_depth;
+    merge_calls += other.merge_calls;
+    merge_nodes += other.merge_nodes;
+    merge_depth = other.merge_depth > merge_depth ? other.merge_depth : merge_depth;
+    reorder_calls += other.reorder_calls;
+    max_latency = other.max_latency > max_latency ? other.max_latency : max_latency;
+    fused_queries += other.fused_queries;
+    removed_queries += other.removed_queries;
+    for (int i = 0; i < histogram_size; ++i) {
+        latency[i] += other.latency[i];
     }
-    update(result);
 }
 
-void treap::split(node *root, node *&left, node *&right, const int position) {
-    if (!root) {
-        left = right = nullptr;
-        return;
+unsigned long long treap_instrumentation::percentile(const double share) const {
+    if (reorder_calls == 0) {
+        return 0;
     }
-    if (position <= size(root->left)) {
-        split(root->left, left, root->left, position), right = root;
-    } else {
-        split(root->right, root->right, right, position - 1 - size(root->left)), left = root;
+    unsigned long long rank = static_cast<unsigned long long>(share * reorder_calls);
+    rank = rank < reorder_calls ? rank : reorder_calls - 1;
+    unsigned long long seen = 0;
+    for (int i = 0; i < histogram_size; ++i) {
+        seen += latency[i];
+        if (seen > rank) {
+            const unsigned long long bound = latency_bound(i);
+            return bound < max_latency ? bound : max_latency;
+        }
     }
-    update(root);
+    return max_latency;
+}
+
+void treap_instrumentation::write(std::ostream &_Ostr) const {
+    _Ostr << "{\"split\": {\"calls\": " << split_calls
+        << ", \"nodes\": " << split_nodes
+        << ", \"max_depth\": " << split_depth << "}"
+        << ", \"merge\": {\"calls\": " << merge_calls
+        << ", \"nodes\": " << merge_nodes
+        << ", \"max_depth\": " << merge_depth << "}"
+        << ", \"reorder\": {\"calls\": " << reorder_calls
+        << ", \"p50_ns\": " << percentile(0.5)
+        << ", \"p99_ns\": " << percentile(0.99)
+        << ", \"max_ns\": " << max_latency << "}"
+        << ", \"fusion\": {\"queries\": " << fused_queries
+        << ", \"removed\": " << removed_queries << "}}" << std::endl;
+}
+
+treap_instrumentation &treap_instrumentation::local() {
+    // Total is created first, so it is destroyed after the counters of the main thread.
+    static instrumentation_total total;
+    thread_local instrumentation_thread counters(total);
+    return counters.counters;
 }
+#endif
+
+query::query() : left_position(0), right_position(0) {}
 
-void treap::insert(node *&root, node *item, const int position) {
-    node *before, *after;
-    split(root, before, after, position);
-    merge(before, item, before);
-    merge(before, after, root);
+query::query(const int left, const int right)
+    : left_position(left),
+    right_position(right) {
 }
 
-void treap::get_elements(node *root, std::vector<int> &elements) {
-    if (root->left) {
-        get_elements(root->left, elements);
+
+// Struct query_collector.
+// Engine for query_fuser that keeps the fused queries instead of applying them.
+struct query_collector {
+    // Field std::vector<query> &queries - list of the fused queries.
+    std::vector<query> &queries;
+
+    // Function reorder - add the fused query to the list.
+    // Parameter const long long left - left position of the query.
+    // Parameter const long long right - right position of the query.
+    void reorder(const long long left, const long long right) {
+        queries.push_back(query(static_cast<int>(left), static_cast<int>(right)));
     }
-    elements.push_back(root->value);
-    if (root->right) {
-        get_elements(root->right, elements);
+};
+
+int fuse_queries(std::vector<query> &queries) {
+    std::vector<query> fused;
+    fused.reserve(queries.size());
+    query_collector collector = { fused };
+    query_fuser fuser;
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        fuser.push(queries[i].left_position, queries[i].right_position, collector);
     }
+    fuser.flush(collector);
+    queries.swap(fused);
+    return fuser.get_removed_count();
 }
 
-std::vector<int> treap::get_elements() {
-    std::vector<int> result;
-    if (root) {
-        get_elements(root, result);
-    }
-    return result;
+query_fuser::query_fuser() : queries_count(0), applied_count(0) {}
+
+int query_fuser::get_queries_count() const {
+    return queries_count;
+}
+
+int query_fuser::get_removed_count() const {
+    return queries_count - applied_count;
 }
 
-std::string treap::get_description(node *root) {
-    std::string res = "";
-    if (root->left) {
-        res = res + get_description(root->left);
+// Function fits_flat_array - check if the problem can be solved by flat_array.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter const std::vector<query> &queries - list of queries.
+// Return bool - true if the array is small and every query is inside it.
+static bool fits_flat_array(
+    const int size,
+    const int queries_count,
+    const std::vector<query> &queries) {
+
+    if (size > flat_array_threshold) {
+        return false;
     }
-    res = res + std::to_string(root->value) + " ";
-    if (root->right) {
-        res = res + get_description(root->right);
+    const int available = static_cast<int>(queries.size());
+    for (int i = 0; i < queries_count && i < available; ++i) {
+        if (queries[i].left_position < 1
+            || queries[i].left_position > queries[i].right_position
+            || queries[i].right_position > size) {
+            return false;
+        }
     }
-    return res;
+    return true;
 }
 
-treap::node* treap::reorder(node *root, const int left, const int right) {
-    node *before_left, *after_left;
-    split(root, before_left, after_left, left - 1);
+std::vector<int> solve(
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries) {
 
-    node *between_left_and_right, *after_right;
-    split(after_left, between_left_and_right, after_right, right - left + 1);
+    treap tree(0);
+    return solve(tree, size, queries_count, queries);
+}
 
-    node *temp, *result;
-    merge(between_left_and_right, before_left, temp);
-    merge(temp, after_right, result);
+std::vector<int> solve(
+    treap &tree,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries) {
 
-    return result;
+    if (fits_flat_array(size, queries_count, queries)) {
+        flat_array array(0);
+        apply_queries(array, size, queries_count, queries);
+        return array.get_elements();
+    }
+    apply_queries(tree, size, queries_count, queries);
+    return tree.get_elements();
 }
 
-treap::node* treap::build(
-    const int left,
-    const int right,
-    std::vector<int> &values) {
+void solve(
+    treap &tree,
+    flat_array &array,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries,
+    output_writer &writer) {
 
-    const int index = (left + right + 1) / 2;
-    if (index > values.size() || index <= 0 || left > right) {
-        return nullptr;
+    if (fits_flat_array(size, queries_count, queries)) {
+        apply_queries(array, size, queries_count, queries);
+        write_data(writer, array);
+    } else {
+        apply_queries(tree, size, queries_count, queries);
+        write_data(writer, tree);
     }
-    node *root = new node(values[index - 1]);
-    root->left = build(left, index - 1, values);
-    root->right = build(index + 1, right, values);
-    update(root);
-    return root;
 }
 
+// Function apply_fused - fuse the queries and apply them to the array of any engine.
+// Queries are fused in a copy, the list of the caller is not changed.
+template <typename Engine>
+static void apply_fused(
+    Engine &engine,
+    const int size,
+    const int queries_count,
+    const std::vector<query> &queries) {
+
+    const int available = static_cast<int>(queries.size());
+    const int count = queries_count < available ? queries_count : available;
+    std::vector<query> fused(queries.begin(), queries.begin() + count);
+    const int removed_count = fuse_queries(fused);
+    TREAP_RECORD_FUSION(count, removed_count);
 
-query::query() : left_position(0), right_position(0) {}
+    engine.assign(size);
 
-query::query(const int left, const int right)
-    : left_position(left),
-    right_position(right) {
+    for (std::size_t i = 0; i < fused.size(); ++i) {
+        engine.reorder(fused[i].left_position, fused[i].right_position);
+    }
 }
 
-
-std::vector<int> solve(
+void apply_queries(
+    treap &tree,
     const int size,
     const int queries_count,
     std::vector<query> &queries) {
 
-    treap *root = new treap(size);
+    apply_fused(tree, size, queries_count, queries);
+}
 
-    for (int i = 0; i < queries_count; ++i) {
-        root->reorder(queries[i].left_position, queries[i].right_position);
-    }
+void apply_queries(
+    flat_array &array,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries) {
 
-    return root->get_elements();
+    apply_fused(array, size, queries_count, queries);
 }
 
 void read_data(
@@ -179,28 +353,941 @@ void read_data(
     }
 }
 
+mapped_file::mapped_file(const std::string &path)
+    : mapping(nullptr),
+    mapping_size(0) {
+
+#ifndef _WIN32
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        throw std::runtime_error("cannot open file " + path);
+    }
+    struct stat status;
+    const bool has_status = fstat(descriptor, &status) == 0;
+    if (has_status && status.st_size > 0) {
+        void *address = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (address != MAP_FAILED) {
+            mapping = static_cast<char *>(address);
+            mapping_size = status.st_size;
+        }
+    }
+    close(descriptor);
+    if (mapping || (has_status && status.st_size == 0)) {
+        return;
+    }
+#endif
+    std::ifstream input(path.c_str(), std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("cannot open file " + path);
+    }
+    buffer.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    mapping_size = buffer.size();
+}
+
+mapped_file::~mapped_file() {
+#ifndef _WIN32
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+#endif
+}
+
+const char *mapped_file::data() const {
+    return mapping ? mapping : buffer.data();
+}
+
+std::size_t mapped_file::size() const {
+    return mapping_size;
+}
+
+input_reader::input_reader(const int descriptor)
+    : descriptor(descriptor),
+    owns_descriptor(false) {
+
+    open();
+}
+
+input_reader::input_reader(const std::string &path)
+    : descriptor(-1),
+    owns_descriptor(true) {
+
+#ifdef _WIN32
+    descriptor = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    descriptor = ::open(path.c_str(), O_RDONLY);
+#endif
+    if (descriptor < 0) {
+        throw std::runtime_error("cannot open input file " + path);
+    }
+    open();
+}
+
+input_reader::~input_reader() {
+#ifndef _WIN32
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+    if (owns_descriptor) {
+        close(descriptor);
+    }
+#else
+    if (owns_descriptor) {
+        _close(descriptor);
+    }
+#endif
+}
+
+void input_reader::open() {
+    mapping = nullptr;
+    mapping_size = 0;
+    current = end = nullptr;
+    consumed = 0;
+#ifndef _WIN32
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+        void *address = mmap(
+            nullptr,
+            status.st_size,
+            PROT_READ,
+            MAP_PRIVATE,
+            descriptor,
+            0);
+        if (address != MAP_FAILED) {
+            madvise(address, status.st_size, MADV_SEQUENTIAL);
+            mapping = static_cast<char *>(address);
+            mapping_size = status.st_size;
+            current = mapping;
+            end = mapping + mapping_size;
+            return;
+        }
+    }
+#endif
+    buffer.resize(buffer_size);
+    current = end = buffer.data();
+}
+
+bool input_reader::refill() {
+    if (mapping) {
+        return false;
+    }
+    consumed += end - buffer.data();
+    current = end = buffer.data();
+    while (true) {
+#ifdef _WIN32
+        const long long count = _read(descriptor, buffer.data(), buffer_size);
+#else
+        const long long count = read(descriptor, buffer.data(), buffer_size);
+#endif
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            fail("cannot read input");
+        }
+        end = buffer.data() + count;
+        return count > 0;
+    }
+}
+
+void input_reader::fail(const std::string &message) {
+    const long long position = consumed + (current - (mapping ? mapping : buffer.data()));
+    throw std::runtime_error(message + " at byte " + std::to_string(position));
+}
+
+int input_reader::read_int() {
+    return static_cast<int>(read_integer(std::numeric_limits<int>::max()));
+}
+
+long long input_reader::read_long() {
+    return read_integer(std::numeric_limits<long long>::max());
+}
+
+long long input_reader::read_integer(const unsigned long long limit) {
+    while (true) {
+        if (current == end && !refill()) {
+            fail("unexpected end of input");
+        }
+        const char symbol = *current;
+        if (symbol != ' ' && symbol != '\n' && symbol != '\r' && symbol != '\t') {
+            break;
+        }
+        ++current;
+    }
+
+    bool negative = false;
+    if (*current == '-' || *current == '+') {
+        negative = *current == '-';
+        ++current;
+    }
+
+    // Absolute value is accumulated, negative numbers may be one larger.
+    const unsigned long long bound = negative ? limit + 1 : limit;
+    unsigned long long value = 0;
+    int digits_count = 0;
+    while (true) {
+        if (current == end && !refill()) {
+            break;
+        }
+        const unsigned digit = static_cast<unsigned char>(*current) - '0';
+        if (digit > 9) {
+            break;
+        }
+        if (value > (bound - digit) / 10) {
+            fail("integer is out of range");
+        }
+        value = value * 10 + digit;
+        ++digits_count;
+        ++current;
+    }
+    if (digits_count == 0) {
+        fail("integer expected");
+    }
+    if (current != end) {
+        const char symbol = *current;
+        if (symbol != ' ' && symbol != '\n' && symbol != '\r' && symbol != '\t') {
+            fail(std::string("unexpected character '") + symbol + "'");
+        }
+    }
+    return negative ? static_cast<long long>(0 - value) : static_cast<long long>(value);
+}
+
+void read_data(
+    input_reader &reader,
+    int &size,
+    int &queries_count,
+    std::vector<query> &queries) {
+
+    size = reader.read_int();
+    queries_count = reader.read_int();
+    if (size < 0 || queries_count < 0) {
+        throw std::runtime_error("number of elements and queries must not be negative");
+    }
+
+    queries.resize(queries_count);
+
+    for (int i = 0; i < queries_count; ++i) {
+        queries[i] = read_query(reader, size, i);
+    }
+}
+
+query read_query(input_reader &reader, const int size, const int index) {
+    const int left = reader.read_int();
+    const int right = reader.read_int();
+    if (left < 1 || left > right || right > size) {
+        throw std::runtime_error(
+            "query " + std::to_string(index + 1) + " must satisfy 1 <= left <= right <= size");
+    }
+    return query(left, right);
+}
+
+std::vector<int> solve_stream(input_reader &reader) {
+    treap tree(0);
+    solve_stream(reader, tree);
+    return tree.get_elements();
+}
+
+void solve_stream(input_reader &reader, treap &tree) {
+    const int size = reader.read_int();
+    const int queries_count = reader.read_int();
+    if (size < 0 || queries_count < 0) {
+        throw std::runtime_error("number of elements and queries must not be negative");
+    }
+
+    tree.assign(size);
+
+    query_fuser fuser;
+    for (int i = 0; i < queries_count; ++i) {
+        const query current = read_query(reader, size, i);
+        fuser.push(current.left_position, current.right_position, tree);
+    }
+    fuser.flush(tree);
+    TREAP_RECORD_FUSION(fuser.get_queries_count(), fuser.get_removed_count());
+}
+
+void solve_pipelined(input_reader &reader, treap &tree, output_writer &writer) {
+    const int size = reader.read_int();
+    const int queries_count = reader.read_int();
+    if (size < 0 || queries_count < 0) {
+        throw std::runtime_error("number of elements and queries must not be negative");
+    }
+
+    const std::size_t batch_size = 1024;
+
+    spsc_ring<query> queries(1 << 16);
+    std::exception_ptr parse_error;
+    std::thread parser([&reader, &queries, &parse_error, size, queries_count, batch_size]() {
+        try {
+            std::vector<query> batch(batch_size);
+            std::size_t count = 0;
+            for (int i = 0; i < queries_count; ++i) {
+                batch[count++] = read_query(reader, size, i);
+                if (count == batch_size) {
+                    if (!queries.write(batch.data(), count)) {
+                        return;
+                    }
+                    count = 0;
+                }
+            }
+            queries.write(batch.data(), count);
+        } catch (...) {
+            parse_error = std::current_exception();
+        }
+        queries.close();
+    });
+
+    try {
+        tree.assign(size);
+
+        // Queries are fused as in solve_stream.
+        std::vector<query> batch(batch_size);
+        query_fuser fuser;
+        std::size_t count;
+        while ((count = queries.read(batch.data(), batch_size)) != 0) {
+            for (std::size_t i = 0; i < count; ++i) {
+                fuser.push(batch[i].left_position, batch[i].right_position, tree);
+            }
+        }
+        fuser.flush(tree);
+        TREAP_RECORD_FUSION(fuser.get_queries_count(), fuser.get_removed_count());
+    } catch (...) {
+        queries.cancel();
+        parser.join();
+        throw;
+    }
+    parser.join();
+    if (parse_error) {
+        std::rethrow_exception(parse_error);
+    }
+
+    spsc_ring<int> elements(1 << 16);
+    std::thread extractor([&tree, &elements, batch_size]() {
+        std::vector<int> batch(batch_size);
+        std::size_t count = 0;
+        tree.for_each([&elements, &batch, &count, batch_size](const int value) {
+            batch[count++] = value;
+            if (count == batch_size) {
+                elements.write(batch.data(), count);
+                count = 0;
+            }
+        });
+        elements.write(batch.data(), count);
+        elements.close();
+    });
+
+    try {
+        std::vector<int> batch(batch_size);
+        std::size_t count;
+        while ((count = elements.read(batch.data(), batch_size)) != 0) {
+            for (std::size_t i = 0; i < count; ++i) {
+                writer.write_int(batch[i]);
+                writer.write_char(' ');
+            }
+        }
+    } catch (...) {
+        elements.cancel();
+        extractor.join();
+        throw;
+    }
+    extractor.join();
+}
+
+run_treap::run_treap(const long long size, const std::uint64_t seed) {
+    assign(size, seed);
+}
+
+void run_treap::assign(const long long size, const std::uint64_t seed) {
+    nodes.clear();
+    path.clear();
+    priority_state = seed;
+    nodes.push_back(node());
+    nodes[0].start = nodes[0].length = nodes[0].size = 0;
+    nodes[0].priority = nodes[0].left = nodes[0].right = 0;
+    root = size > 0 ? create_node(1, size) : 0;
+}
+
+void run_treap::reorder(const long long left, const long long right) {
+    cut(left - 1);
+    cut(right);
+
+    node_index before_left, after_left;
+    split(root, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    node_index temp;
+    merge(between_left_and_right, before_left, temp);
+    merge(temp, after_right, root);
+}
+
+std::vector<long long> run_treap::get_elements() {
+    std::vector<long long> result;
+    result.reserve(size(root));
+    for_each_run([&result](const long long start, const long long length) {
+        for (long long value = start; value < start + length; ++value) {
+            result.push_back(value);
+        }
+    });
+    return result;
+}
+
+long long run_treap::size() {
+    return size(root);
+}
+
+std::size_t run_treap::runs_count() {
+    return nodes.size() - 1;
+}
+
+run_treap::node_index run_treap::create_node(const long long start, const long long length) {
+    node created;
+    created.start = start;
+    created.length = length;
+    created.size = length;
+    created.priority = hash_priority(priority_state += priority_step);
+    created.left = created.right = 0;
+    nodes.push_back(created);
+    return static_cast<node_index>(nodes.size() - 1);
+}
+
+long long run_treap::size(const node_index index) {
+    return nodes[index].size;
+}
+
+void run_treap::cut(const long long position) {
+    if (position <= 0 || position >= size(root)) {
+        return;
+    }
+
+    path.clear();
+    node_index current = root;
+    long long remaining = position;
+    while (true) {
+        const long long left_size = size(nodes[current].left);
+        if (remaining < left_size) {
+            path.push_back(current);
+            current = nodes[current].left;
+        } else if (remaining >= left_size + nodes[current].length) {
+            path.push_back(current);
+            remaining -= left_size + nodes[current].length;
+            current = nodes[current].right;
+        } else {
+            break;
+        }
+    }
+    const long long offset = remaining - size(nodes[current].left);
+    if (offset == 0) {
+        return;
+    }
+
+    // End of the run is removed from the node and inserted back as a new node.
+    const long long moved = nodes[current].length - offset;
+    const node_index inserted = create_node(nodes[current].start + offset, moved);
+    nodes[current].length = offset;
+    nodes[current].size -= moved;
+    for (std::size_t i = 0; i < path.size(); ++i) {
+        nodes[path[i]].size -= moved;
+    }
+
+    node_index *slot = &root;
+    remaining = position;
+    while (*slot && nodes[*slot].priority > nodes[inserted].priority) {
+        node &owner = nodes[*slot];
+        owner.size += moved;
+        const long long left_size = size(owner.left);
+        if (remaining <= left_size) {
+            slot = &owner.left;
+        } else {
+            remaining -= left_size + owner.length;
+            slot = &owner.right;
+        }
+    }
+    split(*slot, nodes[inserted].left, nodes[inserted].right, remaining);
+    nodes[inserted].size = size(nodes[inserted].left) + moved + size(nodes[inserted].right);
+    *slot = inserted;
+}
+
+void run_treap::merge(node_index left, node_index right, node_index &result) {
+    node_index *slot = &result;
+    while (left && right) {
+        if (nodes[left].priority > nodes[right].priority) {
+            nodes[left].size += nodes[right].size;
+            *slot = left;
+            slot = &nodes[left].right;
+            left = nodes[left].right;
+        } else {
+            nodes[right].size += nodes[left].size;
+            *slot = right;
+            slot = &nodes[right].left;
+            right = nodes[right].left;
+        }
+    }
+    *slot = left ? left : right;
+}
+
+void run_treap::split(
+    node_index root,
+    node_index &left,
+    node_index &right,
+    const long long position) {
+
+    node_index *left_slot = &left;
+    node_index *right_slot = &right;
+    long long remaining = position;
+    while (root) {
+        node &current = nodes[root];
+        const long long left_size = size(current.left);
+        if (remaining <= left_size) {
+            current.size -= remaining;
+            *right_slot = root;
+            right_slot = &current.left;
+            root = current.left;
+        } else {
+            if (remaining < current.size) {
+                current.size = remaining;
+            }
+            remaining -= left_size + current.length;
+            *left_slot = root;
+            left_slot = &current.right;
+            root = current.right;
+        }
+    }
+    *left_slot = *right_slot = 0;
+}
+
+void solve_runs(input_reader &reader, run_treap &tree) {
+    const long long size = reader.read_long();
+    const int queries_count = reader.read_int();
+    if (size < 0 || queries_count < 0) {
+        throw std::runtime_error("number of elements and queries must not be negative");
+    }
+
+    tree.assign(size);
+
+    // Queries are fused as in solve_stream.
+    query_fuser fuser;
+    for (int i = 0; i < queries_count; ++i) {
+        const long long left = reader.read_long();
+        const long long right = reader.read_long();
+        if (left < 1 || left > right || right > size) {
+            throw std::runtime_error(
+                "query " + std::to_string(i + 1) + " must satisfy 1 <= left <= right <= size");
+        }
+        fuser.push(left, right, tree);
+    }
+    fuser.flush(tree);
+    TREAP_RECORD_FUSION(fuser.get_queries_count(), fuser.get_removed_count());
+}
+
+// Two digits of every number from 0 up to 99.
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+output_writer::output_writer(const int descriptor)
+    : descriptor(descriptor),
+    stream(nullptr),
+    buffer(buffer_size),
+    current(buffer.data()) {
+}
+
+output_writer::output_writer(std::ostream &_Ostr)
+    : descriptor(-1),
+    stream(&_Ostr),
+    buffer(buffer_size),
+    current(buffer.data()) {
+}
+
+output_writer::~output_writer() {
+    try {
+        flush();
+    } catch (const std::exception &) {
+    }
+}
+
+void output_writer::write_int(const long long value) {
+    // Longest integer with the sign takes 20 characters.
+    if (buffer.data() + buffer_size - current < 20) {
+        flush();
+    }
+    unsigned long long rest = static_cast<unsigned long long>(value);
+    if (value < 0) {
+        *current++ = '-';
+        rest = 0 - rest;
+    }
+    char digits[20];
+    char *first = digits + sizeof(digits);
+    while (rest >= 100) {
+        const char *pair = digit_pairs + (rest % 100) * 2;
+        rest /= 100;
+        *--first = pair[1];
+        *--first = pair[0];
+    }
+    if (rest >= 10) {
+        *--first = digit_pairs[rest * 2 + 1];
+        *--first = digit_pairs[rest * 2];
+    } else {
+        *--first = static_cast<char>('0' + rest);
+    }
+    const std::size_t length = digits + sizeof(digits) - first;
+    std::memcpy(current, first, length);
+    current += length;
+}
+
+void output_writer::write_char(const char symbol) {
+    if (current == buffer.data() + buffer_size) {
+        flush();
+    }
+    *current++ = symbol;
+}
+
+void output_writer::write_string(const std::string &text) {
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        write_char(text[i]);
+    }
+}
+
+void output_writer::flush() {
+    const char *first = buffer.data();
+    if (stream) {
+        stream->write(first, current - first);
+        current = buffer.data();
+        if (!*stream) {
+            throw std::runtime_error("cannot write output");
+        }
+        return;
+    }
+    while (first != current) {
+#ifdef _WIN32
+        const long long count = _write(descriptor, first, static_cast<unsigned>(current - first));
+#else
+        const long long count = write(descriptor, first, current - first);
+#endif
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            current = buffer.data();
+            throw std::runtime_error("cannot write output");
+        }
+        first += count;
+    }
+    current = buffer.data();
+}
+
 void write_data(
     std::ostream &_Ostr,
     const std::vector<int> &data) {
 
+    output_writer writer(_Ostr);
     for (int i = 0; i < data.size(); ++i) {
-        _Ostr << data[i] << " ";
+        writer.write_int(data[i]);
+        writer.write_char(' ');
+    }
+    writer.flush();
+}
+
+void write_data(
+    output_writer &writer,
+    treap &tree) {
+
+    tree.for_each([&writer](const int value) {
+        writer.write_int(value);
+        writer.write_char(' ');
+    });
+}
+
+void write_data(
+    output_writer &writer,
+    flat_array &array) {
+
+    array.for_each([&writer](const int value) {
+        writer.write_int(value);
+        writer.write_char(' ');
+    });
+}
+
+void write_data(
+    output_writer &writer,
+    run_treap &tree) {
+
+    tree.for_each_run([&writer](const long long start, const long long length) {
+        for (long long value = start; value < start + length; ++value) {
+            writer.write_int(value);
+            writer.write_char(' ');
+        }
+    });
+}
+
+batch_solver::batch_solver(const int threads_count, std::ostream &_Ostr)
+    : output(_Ostr),
+    added(0),
+    written(0),
+    failed(0),
+    closed(false) {
+
+    for (int i = 0; i < threads_count; ++i) {
+        threads.push_back(std::thread(&batch_solver::work, this));
+    }
+}
+
+batch_solver::~batch_solver() {
+    finish();
+}
+
+void batch_solver::add(const std::string &path) {
+    task current;
+    current.path = path;
+    current.size = 0;
+    push(current);
+}
+
+void batch_solver::add(const int size, std::vector<query> &queries) {
+    task current;
+    current.size = size;
+    current.queries.swap(queries);
+    push(current);
+}
+
+int batch_solver::finish() {
+    std::unique_lock<std::mutex> guard(lock);
+    if (!closed) {
+        closed = true;
+        changed.notify_all();
+        while (written < added) {
+            flush(guard);
+            if (written < added) {
+                changed.wait(guard);
+            }
+        }
+        guard.unlock();
+        for (std::size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+        guard.lock();
+    }
+    return failed;
+}
+
+void batch_solver::push(task &current) {
+    std::unique_lock<std::mutex> guard(lock);
+    const std::size_t limit = threads.size() * pending_per_thread;
+    while (true) {
+        flush(guard);
+        if (pending.size() < limit) {
+            break;
+        }
+        changed.wait(guard);
+    }
+    current.index = added++;
+    pending.push_back(task());
+    pending.back().index = current.index;
+    pending.back().path.swap(current.path);
+    pending.back().size = current.size;
+    pending.back().queries.swap(current.queries);
+    changed.notify_all();
+}
+
+void batch_solver::work() {
+    treap tree(0);
+    flat_array array(0);
+    task current;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (pending.empty() && !closed) {
+                changed.wait(guard);
+            }
+            if (pending.empty()) {
+                return;
+            }
+            current.index = pending.front().index;
+            current.path.swap(pending.front().path);
+            current.size = pending.front().size;
+            current.queries.swap(pending.front().queries);
+            pending.pop_front();
+            changed.notify_all();
+        }
+
+        std::ostringstream result;
+        bool success = true;
+        try {
+            int queries_count = current.queries.size();
+            if (!current.path.empty()) {
+                input_reader reader(current.path);
+                read_data(reader, current.size, queries_count, current.queries);
+            }
+            output_writer writer(result);
+            solve(tree, array, current.size, queries_count, current.queries, writer);
+            writer.flush();
+        } catch (const std::exception &error) {
+            std::unique_lock<std::mutex> guard(lock);
+            std::cerr << "error: input " << current.index + 1 << ": " << error.what() << std::endl;
+            success = false;
+        }
+        result << "\n";
+
+        std::unique_lock<std::mutex> guard(lock);
+        failed += success ? 0 : 1;
+        finished[current.index] = success ? result.str() : std::string("\n");
+        changed.notify_all();
     }
 }
 
-int main() {
+void batch_solver::flush(std::unique_lock<std::mutex> &guard) {
+    std::vector<std::string> ready;
+    std::map<std::size_t, std::string>::iterator next = finished.begin();
+    while (next != finished.end() && next->first == written + ready.size()) {
+        ready.push_back(std::string());
+        ready.back().swap(next->second);
+        finished.erase(next++);
+    }
+    if (ready.empty()) {
+        return;
+    }
+    guard.unlock();
+    for (std::size_t i = 0; i < ready.size(); ++i) {
+        output << ready[i];
+    }
+    guard.lock();
+    written += ready.size();
+    changed.notify_all();
+}
+
+int solve_batch(
+    const std::vector<std::string> &paths,
+    const int threads_count,
+    std::ostream &_Ostr) {
+
+    batch_solver solver(threads_count, _Ostr);
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+        solver.add(paths[i]);
+    }
+    return solver.finish();
+}
+
+int solve_batch(
+    input_reader &reader,
+    const int threads_count,
+    std::ostream &_Ostr) {
+
+    batch_solver solver(threads_count, _Ostr);
+    const int inputs_count = reader.read_int();
+    if (inputs_count < 0) {
+        throw std::runtime_error("number of inputs must not be negative");
+    }
+    for (int i = 0; i < inputs_count; ++i) {
+        int size, queries_count;
+        std::vector<query> queries;
+        read_data(reader, size, queries_count, queries);
+        solver.add(size, queries);
+    }
+    return solver.finish();
+}
+
+#ifndef TREAP_BENCHMARK
+int main(int argc, char *argv[]) {
     std::ios_base::sync_with_stdio(false);
     std::cin.tie(nullptr);
     std::cout.tie(nullptr);
 
-    int size, queries_count;
-    std::vector<query> queries;
+    bool stream = false;
+    bool runs = false;
+    bool pipeline = false;
+    bool batch = false;
+    const long max_threads = 1 << 12;
+    int threads_count = std::thread::hardware_concurrency();
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--stream") {
+            stream = true;
+        } else if (argument == "--pipeline") {
+            pipeline = true;
+        } else if (argument == "--runs") {
+            runs = true;
+        } else if (argument == "--batch") {
+            batch = true;
+        } else if (argument == "--threads") {
+            if (i + 1 == argc) {
+                std::cerr << "error: --threads needs a value" << std::endl;
+                return 1;
+            }
+            const char *value = argv[++i];
+            char *end;
+            errno = 0;
+            const long count = std::strtol(value, &end, 10);
+            if (end == value || *end || errno == ERANGE || count <= 0 || count > max_threads) {
+                std::cerr << "error: --threads must be a number from 1 to " << max_threads
+                    << ", got '" << value << "'" << std::endl;
+                return 1;
+            }
+            threads_count = static_cast<int>(count);
+        } else if (argument.compare(0, 2, "--") == 0) {
+            std::cerr << "error: unknown option " << argument << std::endl;
+            return 1;
+        } else {
+            paths.push_back(argument);
+        }
+    }
+    if (!batch && paths.size() > 1) {
+        std::cerr << "error: only one input file is read without --batch" << std::endl;
+        return 1;
+    }
+    const std::string path = paths.empty() ? std::string() : paths.back();
 
-    read_data(std::cin, size, queries_count, queries);
+    treap tree(0);
 
-    const std::vector<int> result = solve(size, queries_count, queries);
+    try {
+        if (batch) {
+            threads_count = threads_count > 0 ? threads_count : 1;
+            int failed;
+            if (paths.empty()) {
+                input_reader reader(0);
+                failed = solve_batch(reader, threads_count, std::cout);
+            } else {
+                failed = solve_batch(paths, threads_count, std::cout);
+            }
+            return failed == 0 ? 0 : 1;
+        }
 
-    write_data(std::cout, result);
+        std::unique_ptr<input_reader> reader(
+            path.empty() ? new input_reader(0) : new input_reader(path));
+        if (runs) {
+            run_treap compressed(0);
+            solve_runs(*reader, compressed);
+            output_writer writer(1);
+            write_data(writer, compressed);
+            writer.flush();
+            return 0;
+        }
+        output_writer writer(1);
+        if (pipeline) {
+            solve_pipelined(*reader, tree, writer);
+        } else if (stream) {
+            solve_stream(*reader, tree);
+            write_data(writer, tree);
+        } else {
+            int size, queries_count;
+            std::vector<query> queries;
+            read_data(*reader, size, queries_count, queries);
+            flat_array array(0);
+            solve(tree, array, size, queries_count, queries, writer);
+        }
+        writer.flush();
+    } catch (const std::exception &error) {
+        std::cerr << "error: " << error.what() << std::endl;
+        return 1;
+    }
 
     return 0;
 }
+#endif
@@ -1,162 +1,4462 @@
 #pragma once
 
 #include <iostream>
+#include <sstream>
 #include <istream>
+#include <fstream>
 #include <vector>
 #include <string>
 #include <utility>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <type_traits>
+#include <stdexcept>
+#include <memory>
+#include <unordered_map>
+#include <deque>
+#include <iterator>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <typeinfo>
 
-struct treap {
+#ifdef TREAP_INSTRUMENTATION
+#include <chrono>
+#endif
+
+// Struct no_aggregate.
+// Aggregate policy of the treap that maintains nothing except sizes.
+struct no_aggregate {
+    // Type result_type - aggregate is empty.
+    struct result_type {};
+};
+
+// Struct sum_aggregate.
+// Aggregate policy of the treap that maintains sum of the elements.
+template <typename T>
+struct sum_aggregate {
+    // Type result_type - type of the sum.
+    typedef T result_type;
+
+    // Function identity - sum of no elements.
+    static result_type identity();
+
+    // Function lift - sum of one element.
+    static result_type lift(const T &value);
+
+    // Function combine - sum of two consecutive parts of the array.
+    static result_type combine(const result_type &left, const result_type &right);
+};
+
+// Struct min_aggregate.
+// Aggregate policy of the treap that maintains minimum of the elements.
+template <typename T>
+struct min_aggregate {
+    // Type result_type - type of the minimum.
+    typedef T result_type;
+
+    // Function identity - minimum of no elements.
+    static result_type identity();
+
+    // Function lift - minimum of one element.
+    static result_type lift(const T &value);
+
+    // Function combine - minimum of two consecutive parts of the array.
+    static result_type combine(const result_type &left, const result_type &right);
+};
+
+// Struct max_aggregate.
+// Aggregate policy of the treap that maintains maximum of the elements.
+template <typename T>
+struct max_aggregate {
+    // Type result_type - type of the maximum.
+    typedef T result_type;
+
+    // Function identity - maximum of no elements.
+    static result_type identity();
+
+    // Function lift - maximum of one element.
+    static result_type lift(const T &value);
+
+    // Function combine - maximum of two consecutive parts of the array.
+    static result_type combine(const result_type &left, const result_type &right);
+};
+
+// Struct treap_summary.
+// Summary of the subtree that is stored in the treap node.
+template <typename Aggregate>
+struct treap_summary {
+    // Field summary - aggregate of the elements in the subtree.
+    typename Aggregate::result_type summary;
+
+    // Initialization with aggregate of no elements.
+    treap_summary();
+};
+
+// Struct treap_summary without aggregate - takes no space in the node.
+template <>
+struct treap_summary<no_aggregate> {
+};
+
+// Function hash_priority - find priority of the treap node by the key (splitmix64 mixer).
+// Parameter std::uint64_t key - key of the priority.
+// Return std::uint32_t - pseudo-random 31-bit priority.
+std::uint32_t hash_priority(std::uint64_t key);
+
+// Default seed of the generator of the node priorities.
+const std::uint64_t default_seed = 0x2545f4914f6cdd1dULL;
+
+// Step of the generator of the node priorities, keys of the consecutive nodes differ by it.
+const std::uint64_t priority_step = 0x9e3779b97f4a7c15ULL;
+
+#ifdef TREAP_INSTRUMENTATION
+// Struct treap_instrumentation.
+// Counters of the treap operations made by the current thread.
+// Compiled only with TREAP_INSTRUMENTATION, otherwise the hooks below expand to nothing.
+// Counters of all threads are added together and written as JSON to standard error at exit.
+struct treap_instrumentation {
+public:
+    // Number of buckets in the latency histogram: 8 linear buckets per power of two.
+    static const int histogram_size = 8 * 64;
+
+    // Field unsigned long long split_calls - number of calls of split.
+    unsigned long long split_calls;
+
+    // Field unsigned long long split_nodes - number of nodes visited by split.
+    unsigned long long split_nodes;
+
+    // Field int split_depth - maximal number of nodes visited by one split.
+    int split_depth;
+
+    // Field unsigned long long merge_calls - number of calls of merge.
+    unsigned long long merge_calls;
+
+    // Field unsigned long long merge_nodes - number of nodes visited by merge.
+    unsigned long long merge_nodes;
+
+    // Field int merge_depth - maximal number of nodes visited by one merge.
+    int merge_depth;
+
+    // Field unsigned long long reorder_calls - number of calls of reorder.
+    unsigned long long reorder_calls;
+
+    // Field unsigned long long max_latency - maximal time of one reorder in nanoseconds.
+    unsigned long long max_latency;
+
+    // Field unsigned long long latency[] - histogram of time of reorder in nanoseconds.
+    unsigned long long latency[histogram_size];
+
+    // Field unsigned long long fused_queries - number of queries passed to the fusion.
+    unsigned long long fused_queries;
+
+    // Field unsigned long long removed_queries - number of queries removed by the fusion.
+    unsigned long long removed_queries;
+
+    // Initialization with zero counters.
+    treap_instrumentation();
+
+    // Function record_split - count one call of split.
+    // Parameter const int visited - number of nodes visited by the call.
+    void record_split(const int visited);
+
+    // Function record_merge - count one call of merge.
+    // Parameter const int visited - number of nodes visited by the call.
+    void record_merge(const int visited);
+
+    // Function record_reorder - count one call of reorder.
+    // Parameter const unsigned long long nanoseconds - time of the call.
+    void record_reorder(const unsigned long long nanoseconds);
+
+    // Function record_fusion - count queries of one solved problem.
+    // Parameter const int queries_count - number of queries before the fusion.
+    // Parameter const int removed_count - number of queries that were not applied.
+    void record_fusion(const int queries_count, const int removed_count);
+
+    // Function add - add counters of another thread.
+    // Parameter const treap_instrumentation &other - counters to add.
+    void add(const treap_instrumentation &other);
+
+    // Function percentile - find upper bound of the latency of the given share of calls.
+    // Parameter const double share - share of the calls from 0 up to 1.
+    // Return unsigned long long - latency in nanoseconds.
+    unsigned long long percentile(const double share) const;
+
+    // Function write - write all counters as one JSON object.
+    // Parameter std::ostream &_Ostr - stream to write to.
+    void write(std::ostream &_Ostr) const;
+
+    // Function local - counters of the current thread.
+    // Return treap_instrumentation & - counters that are added to the total
+    // when the thread exits.
+    static treap_instrumentation &local();
+};
+
+// Hooks of the instrumentation that are used in the hot paths of the treap.
+#define TREAP_DECLARE_COUNTER(counter) int counter = 0
+#define TREAP_COUNT_VISIT(counter) (++(counter))
+#define TREAP_RECORD_SPLIT(visited) treap_instrumentation::local().record_split(visited)
+#define TREAP_RECORD_MERGE(visited) treap_instrumentation::local().record_merge(visited)
+#define TREAP_START_TIMER(start) \
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now()
+#define TREAP_RECORD_REORDER(start) \
+    treap_instrumentation::local().record_reorder(static_cast<unsigned long long>( \
+        std::chrono::duration_cast<std::chrono::nanoseconds>( \
+            std::chrono::steady_clock::now() - start).count()))
+#define TREAP_RECORD_FUSION(queries_count, removed_count) \
+    treap_instrumentation::local().record_fusion(queries_count, removed_count)
+#else
+#define TREAP_DECLARE_COUNTER(counter)
+#define TREAP_COUNT_VISIT(counter)
+#define TREAP_RECORD_SPLIT(visited)
+#define TREAP_RECORD_MERGE(visited)
+#define TREAP_START_TIMER(start)
+#define TREAP_RECORD_REORDER(start)
+#define TREAP_RECORD_FUSION(queries_count, removed_count) \
+    (static_cast<void>(queries_count), static_cast<void>(removed_count))
+#endif
+
+// Struct basic_treap.
+// Implicit treap that stores elements of type T and maintains
+// compile-time aggregate policy Aggregate over subsegments.
+// Aggregate policy provides result_type, identity(), lift(value)
+// and associative combine(left, right).
+template <typename T, typename Aggregate = no_aggregate>
+struct basic_treap {
 public:
+    // Struct depth_statistics.
+    // Used for describing the shape of the treap.
+    struct depth_statistics {
+        // Field int max_depth - number of nodes on the longest path from the root.
+        int max_depth;
+
+        // Field double average_depth - average number of nodes on the path
+        // from the root to the node.
+        double average_depth;
+    };
+
+    // Struct iterator.
+    // Forward iterator over the elements in the correct order.
+    // Advance takes amortized O(1), any change of the treap invalidates the iterator.
+    struct iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T *pointer;
+        typedef const T &reference;
+
+        // Initialization - iterator past the last element.
+        iterator();
+
+        // Function operator* - get the current element.
+        // Return reference - the element.
+        reference operator*() const;
+
+        // Function operator-> - get the current element.
+        // Return pointer - the element.
+        pointer operator->() const;
+
+        // Function operator++ - go to the next element.
+        // Return iterator & - the iterator itself.
+        iterator &operator++();
+
+        // Function operator++ - go to the next element.
+        // Return iterator - the iterator before the advance.
+        iterator operator++(int);
+
+        // Function operator== - check if iterators point to the same element.
+        bool operator==(const iterator &other) const;
+
+        // Function operator!= - check if iterators point to different elements.
+        bool operator!=(const iterator &other) const;
+
+    private:
+        friend struct basic_treap;
+
+        // Field basic_treap *tree - treap of the elements.
+        basic_treap *tree;
+
+        // Field stack - node of the current element on the top,
+        // ancestors that go after it below, empty past the last element.
+        std::vector<std::uint32_t> stack;
+
+        // Initialization - iterator to the element at the position.
+        // Parameter basic_treap *tree - treap of the elements.
+        // Parameter const int position - position in the array.
+        iterator(basic_treap *tree, const int position);
+    };
+
+    // Minimal number of elements per thread when the treap is built in parallel.
+    static const int parallel_build_threshold = 1 << 22;
+
+    // Minimal number of elements to retrieve them in parallel.
+    static const int parallel_extract_threshold = 1 << 20;
+
+    // Minimal number of elements in the subtree that is retrieved by one thread.
+    static const int extract_task_size = 1 << 14;
+
     // Initialization - create new treap with elements from 1 up to size.
     // Parameter const int size - number of elements in the array.
-    explicit treap(const int size);
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit basic_treap(const int size, const std::uint64_t seed = default_seed);
 
     // Initialization - create new treap.
-    // Parameter std::vector<int> &values - elements in the array.
-    explicit treap(std::vector<int> &values);
+    // Parameter std::vector<T> &values - elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit basic_treap(std::vector<T> &values, const std::uint64_t seed = default_seed);
+
+    // Function assign - replace all elements with elements from 1 up to size.
+    // Pool of the nodes keeps its memory, so the treap can be reused without allocations.
+    // Parameter const int size - number of elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    void assign(const int size, const std::uint64_t seed = default_seed);
 
     // Function reorder - move subsegment to the start of the array.
     // Parameter const int left - left position in the array.
     // Parameter const int right - right position in the array.
     void reorder(const int left, const int right);
 
+    // Function reverse - reverse order of the elements in subsegment.
+    // Reversal is lazy, so aggregate policy must be commutative to use it.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    void reverse(const int left, const int right);
+
+    // Function move_to - move subsegment to the given position.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Parameter const int position - position of the first moved element
+    // in the resulting array.
+    void move_to(const int left, const int right, const int position);
+
+    // Function rotate - cyclic shift of subsegment to the left.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Parameter const int shift - number of positions, element at position left + shift
+    // becomes the first one (negative value shifts to the right).
+    void rotate(const int left, const int right, const int shift);
+
+    // Function reorder_many - cut the array into pieces and put them in the given order.
+    // All cuts are made in one pass from the top, it visits each node above the cuts once,
+    // then pieces are merged, so it takes O(k log n) for k pieces.
+    // Parameter const std::vector<int> &cuts - sorted positions of the cuts, cut c goes
+    // after the first c elements, so cuts.size() + 1 pieces are made (some may be empty).
+    // Parameter const std::vector<int> &permutation - numbers of the pieces from 0
+    // in the resulting order.
+    // Throws std::invalid_argument if cuts are not sorted, are out of the array
+    // or permutation does not contain every piece exactly once.
+    void reorder_many(const std::vector<int> &cuts, const std::vector<int> &permutation);
+
+    // Function compact - copy the nodes to a new pool in the order of a traversal.
+    // After many reorders neighbouring elements are scattered over the pool,
+    // so extraction and splits touch many cold cache lines.
+    // Links, parents and the index of position_of are rewritten, iterators become invalid.
+    // Parameter const bool van_emde_boas - use van Emde Boas order instead of the order
+    // of the elements: top half of every subtree is stored before its bottom subtrees,
+    // so a path from the root touches few cache lines.
+    void compact(const bool van_emde_boas = false);
+
+    // Function set_compact_period - compact the treap automatically after the given
+    // number of changes (reorder, reverse, move_to, rotate and reorder_many).
+    // Parameter const int period - number of changes, 0 turns automatic compaction off.
+    // Parameter const bool van_emde_boas - order of the nodes, see compact.
+    void set_compact_period(const int period, const bool van_emde_boas = false);
+
     // Function get_elements - retrieve elements from the treap in the correct order.
-    // Return std::vector<int> - list of elements.
-    std::vector<int> get_elements();
+    // Large treaps are cut into subtrees with known places in the list,
+    // subtrees are taken by the threads one by one.
+    // Return std::vector<T> - list of elements.
+    std::vector<T> get_elements();
+
+    // Function for_each - call the function for every element in the correct order,
+    // without building the list of elements.
+    // Parameter Function function - function that takes const T &.
+    template <typename Function>
+    void for_each(Function function);
 
     // Function get_description - get description of the treap - print array.
     // Parameter std::string separator - elements in the treap will be separeted by this string.
     // Return std::string - description of the array.
     std::string get_description(const std::string separator = " ");
 
+    // Function at - find element at the position in O(log n).
+    // Parameter const int position - position in the array.
+    // Throws std::out_of_range if there is no such position.
+    // Return T - the element.
+    T at(const int position);
+
+    // Function get_range - retrieve elements of subsegment in O(log n + right - left).
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Throws std::out_of_range if the subsegment is not in the array.
+    // Return std::vector<T> - list of elements from left to right inclusive.
+    std::vector<T> get_range(const int left, const int right);
+
+    // Function iterator_at - get iterator to the element at the position in O(log n).
+    // Parameter const int position - position in the array.
+    // Return iterator - iterator to the element, end() if position is after the last one.
+    iterator iterator_at(const int position);
+
+    // Function begin - get iterator to the first element.
+    // Return iterator - iterator to the element.
+    iterator begin();
+
+    // Function end - get iterator past the last element.
+    // Return iterator - iterator past the last element.
+    iterator end();
+
+    // Function depth_stats - find maximum and average depth of the nodes.
+    // Priorities are random, so both values are expected to be O(log n)
+    // after any sequence of reorders.
+    // Return depth_statistics - depth of the deepest node and average depth.
+    depth_statistics depth_stats();
+
+    // Function save - write the treap to the binary snapshot file.
+    // Snapshot keeps the pool of the nodes as it is, so elements must be trivially copyable.
+    // Parameter const std::string &path - path to the file.
+    // Throws std::runtime_error if file can not be written.
+    void save(const std::string &path);
+
+    // Function load - read the treap from the binary snapshot file written by save.
+    // File is memory-mapped and the pool is copied from it at once, tree is not rebuilt.
+    // Type of the elements and the aggregate are checked by the tag in the header,
+    // links of the nodes are checked to stay inside the pool.
+    // Parameter const std::string &path - path to the file.
+    // Throws std::runtime_error if file can not be read or is not a snapshot of this treap.
+    // Return basic_treap - loaded treap.
+    static basic_treap load(const std::string &path);
+
+    // Function position_of - find current position of the element in the array.
+    // Node of the element is found by the index of values that is built on the first call,
+    // position is counted by going up by the parents, so it takes O(log n).
+    // If value occurs several times, the node that had it first in the initial array is used.
+    // Parameter const T &value - value of the element.
+    // Return int - position of the element in the array, 0 if there is no such element.
+    int position_of(const T &value);
+
+    // Function get_aggregate - combine elements of subsegment.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Return typename Aggregate::result_type - aggregate of the elements
+    // from left to right inclusive.
+    typename Aggregate::result_type get_aggregate(const int left, const int right);
+
 private:
+    // Type node_index - index of the node in the pool, 0 means no node.
+    typedef std::uint32_t node_index;
+
+    // Type aggregate_tag - std::true_type if the aggregate is maintained.
+    typedef std::integral_constant<
+        bool,
+        !std::is_same<Aggregate, no_aggregate>::value> aggregate_tag;
+
     // Implicit treap node structure.
-    struct node {
+    // Summary of the subtree is stored in the base, it is empty without aggregate.
+    struct node : treap_summary<Aggregate> {
+        // Field value - value that the node stores.
+        T value;
+
         // Field size - number of childs in the node.
         int size;
 
-        // Field value - value that the node stores.
-        const int value;
+        // Field priority - random key, treap is a max-heap by this key.
+        std::uint32_t priority : 31;
+
+        // Field reversed - children of the node must be swapped
+        // and the flag must be passed to them.
+        std::uint32_t reversed : 1;
+
+        // Index of the left child.
+        node_index left;
 
-        // Pointer to the left child.
-        node *left = nullptr;
+        // Index of the right child.
+        node_index right;
 
-        // Pointer to the right child.
-        node *right = nullptr;
+        // Index of the parent, 0 for the root.
+        node_index parent;
 
         // Initialization.
         node();
 
-        // Initialization with given value.
-        explicit node(const int value);
+        // Initialization with given value and priority.
+        node(const T &value, const std::uint32_t priority);
     };
 
-    // Pointer to the root element in the tree.
-    node *root = nullptr;
+    // Struct snapshot_header.
+    // Beginning of the snapshot file, followed by the pool of the nodes.
+    struct snapshot_header {
+        // Field magic - format signature.
+        char magic[8];
 
-    // Function build - create new treap.
-    // Parameter const int left - left bulding border.
-    // Parameter const int right - right bulding border.
-    // Parameter std::vector<int> &values - elements in the array.
-    // Return node* - pointer to the created treap.
-    node* build(
-        const int left,
-        const int right,
-        std::vector<int> &values);
+        // Field node_size - size of the node, it must match when loading.
+        std::uint32_t node_size;
+
+        // Field nodes_count - number of nodes in the pool, including the sentinel.
+        std::uint32_t nodes_count;
+
+        // Field root - index of the root.
+        std::uint32_t root;
+
+        // Field value_size - size of the element, it must match when loading.
+        std::uint32_t value_size;
+
+        // Field priority_state - state of the generator of the node priorities.
+        std::uint64_t priority_state;
+
+        // Field type_tag - hash of the type of the treap, it must match when loading.
+        std::uint64_t type_tag;
+    };
+
+    // Signature of the snapshot file.
+    static const char *snapshot_magic();
+
+    // Function snapshot_type_tag - hash of the name of the treap type (FNV-1a),
+    // so the type of the elements and the aggregate are checked when loading.
+    // Return std::uint64_t - tag of the type.
+    static std::uint64_t snapshot_type_tag();
+
+    // Pool of the nodes - all nodes of the treap are stored contiguously
+    // and released together with the treap.
+    // Node with index 0 is a sentinel with size 0 that stands for no node.
+    std::vector<node> nodes;
+
+    // Index of the root element in the tree.
+    node_index root = 0;
+
+    // Nodes visited by the last split, used only to update summaries.
+    std::vector<node_index> path;
+
+    // Struct cut_frame.
+    // Right subtree that split_many has not visited yet, with the cuts
+    // from first to last (exclusive) that are inside it or on its borders.
+    struct cut_frame {
+        // Field node_index root - root of the subtree.
+        node_index root;
+
+        // Field int offset - number of elements before the subtree in the array.
+        int offset;
+
+        // Field int first - first piece that has elements of the subtree.
+        int first;
+
+        // Field int last - last piece that has elements of the subtree.
+        int last;
+
+        // Field node_index parent - node the subtree was detached from, 0 for the whole treap.
+        node_index parent;
+    };
+
+    // Pieces of the last reorder_many, so the memory is reused by the next call.
+    std::vector<node_index> cut_pieces;
 
-    // Function update - update size of the node.
-    // Parameter node *root - pointer to the node that must be updated.
-    void update(node *root);
+    // Places for the next nodes of the pieces, used by split_many.
+    std::vector<node_index *> cut_slots;
+
+    // Owners of the places of the pieces, parents of their next nodes, used by split_many.
+    std::vector<node_index> cut_owners;
+
+    // Right subtrees that split_many has not visited yet.
+    std::vector<cut_frame> cut_stack;
+
+    // Number of changes between automatic compactions, 0 if it is off.
+    int compact_period = 0;
+
+    // Order of automatic compaction, see compact.
+    bool compact_van_emde_boas = false;
+
+    // Number of changes since the last compaction.
+    int changes_count = 0;
+
+    // Index of the nodes by their values, built by the first call of position_of.
+    std::unordered_map<T, node_index> value_index;
+
+    // State of the generator of the node priorities.
+    std::uint64_t priority_state;
+
+    // Function next_priority - generate priority for the new node.
+    // Return std::uint32_t - pseudo-random priority (splitmix64 sequence).
+    std::uint32_t next_priority();
+
+    // Function create_node - put new node to the pool.
+    // Parameter const T &value - value of the node.
+    // Return node_index - index of the created node.
+    node_index create_node(const T &value);
+
+    // Function build - create new treap in linear time.
+    // Large arrays are cut into parts that are built by separate threads
+    // and merged afterwards.
+    // Parameter std::vector<T> &values - elements in the array.
+    // Return node_index - index of the created treap.
+    node_index build(std::vector<T> &values);
+
+    // Function build_range - create treap from the part of the array in linear time.
+    // Nodes are stored to the reserved part of the pool in the order of the elements,
+    // tree is built as a cartesian tree with the stack of its right spine.
+    // Parameter const std::vector<T> &values - elements in the array.
+    // Parameter const node_index first - index of the node for the first element.
+    // Parameter const int begin - first element of the part.
+    // Parameter const int end - element after the last element of the part.
+    // Parameter const std::uint64_t priority_base - key of the priority before the first element.
+    // Return node_index - index of the created treap.
+    node_index build_range(
+        const std::vector<T> &values,
+        const node_index first,
+        const int begin,
+        const int end,
+        const std::uint64_t priority_base);
+
+    // Function count_change - count change of the treap and compact it
+    // if automatic compaction is on and its period has passed.
+    void count_change();
+
+    // Function in_order_layout - list the nodes in the order of the elements.
+    // Lazy reversals are pushed on the way.
+    // Parameter std::vector<node_index> &order - list where the nodes are appended.
+    void in_order_layout(std::vector<node_index> &order);
+
+    // Function van_emde_boas_layout - list the nodes of the subtree in van Emde Boas order:
+    // top part of half height first, then subtrees below it from left to right,
+    // every part is listed the same way. Lazy reversals must be pushed already.
+    // Parameter node_index root - index of the subtree.
+    // Parameter const int height - number of levels of the subtree to list.
+    // Parameter std::vector<node_index> &order - list where the nodes are appended.
+    // Parameter std::vector<node_index> &roots - roots of the bottom subtrees,
+    // shared by all levels of the recursion.
+    // Parameter std::vector<std::pair<node_index, int> > &stack - stack of the traversal
+    // of the top part, shared by all levels of the recursion.
+    void van_emde_boas_layout(
+        node_index root,
+        const int height,
+        std::vector<node_index> &order,
+        std::vector<node_index> &roots,
+        std::vector<std::pair<node_index, int> > &stack);
+
+    // Function push - pass lazy reversal of the node to its children.
+    // Parameter node_index root - index of the node.
+    void push(node_index root);
+
+    // Function update - update size and summary of the node.
+    // Parameter node_index root - index of the node that must be updated.
+    void update(node_index root);
+
+    // Function update_summary - update summary of the node from its children.
+    // Parameter node_index root - index of the node that must be updated.
+    void update_summary(node_index root, std::true_type);
+
+    // Function update_summary - nothing to update without aggregate.
+    void update_summary(node_index, std::false_type);
+
+    // Function join_summary - store combined summary of two treaps to the node.
+    // Parameter node_index root - index of the node that must be updated.
+    // Parameter node_index left - index of the first treap.
+    // Parameter node_index right - index of the second treap.
+    void join_summary(node_index root, node_index left, node_index right, std::true_type);
+
+    // Function join_summary - nothing to update without aggregate.
+    void join_summary(node_index, node_index, node_index, std::false_type);
+
+    // Function update_path - update summaries of the nodes visited by split,
+    // from the bottom to the top.
+    void update_path(std::true_type);
+
+    // Function update_path - nothing to update without aggregate.
+    void update_path(std::false_type);
 
     // Function size - find number of childs in the node.
     // Returns size of the node (if node is not exist, returns 0).
-    int size(node *root);
+    int size(node_index root);
 
     // Function merge - merge two treaps into new one.
-    // Parameter node *left - pointer to the first treap.
-    // Parameter node *right - pointer to the second treap.
-    // Parameter node *&result - node where should be stored the result of the merging.
-    void merge(node *left, node *right, node *&result);
+    // Goes from the top to the bottom without recursion.
+    // Parameter node_index left - index of the first treap.
+    // Parameter node_index right - index of the second treap.
+    // Parameter node_index &result - node where should be stored the result of the merging.
+    void merge(node_index left, node_index right, node_index &result);
 
     // Function split - split treap into two treaps by position in the array.
-    // Parameter node *root - pointer to the treap that should be split.
-    // Parameter node *&left - node where should be stored the first treap.
-    // Parameter node *&right - node where should be stored the second treap.
+    // Goes from the top to the bottom without recursion.
+    // Parameter node_index root - index of the treap that should be split.
+    // Parameter node_index &left - node where should be stored the first treap.
+    // Parameter node_index &right - node where should be stored the second treap.
+    // Parameter const int position - position in the array.
+    void split(node_index root, node_index &left, node_index &right, const int position);
+
+    // Function split_to - split treap into two treaps and put them to the given places.
+    // Nodes visited to update summaries are added to path, caller must update them.
+    // Parameter node_index root - index of the treap that should be split.
+    // Parameter node_index *left_slot - place for the first treap.
+    // Parameter node_index left_owner - node that owns the place of the first treap, 0 if none.
+    // Parameter node_index *right_slot - place for the second treap.
+    // Parameter node_index right_owner - node that owns the place of the second treap, 0 if none.
     // Parameter const int position - position in the array.
-    void split(node *root, node *&left, node *&right, const int position);
+    void split_to(
+        node_index root,
+        node_index *left_slot,
+        node_index left_owner,
+        node_index *right_slot,
+        node_index right_owner,
+        const int position);
+
+    // Function split_many - split treap into pieces by several positions in the array.
+    // Goes from the top to the bottom once, right subtrees wait on explicit stack,
+    // subtrees without cuts are not visited. Node keeps the part of its left subtree
+    // from its piece as the left child and such part of its right subtree as the right child.
+    // Parameter node_index root - index of the treap that should be split.
+    // Parameter const std::vector<int> &cuts - sorted positions in the array.
+    // Parameter std::vector<node_index> &pieces - where should be stored cuts.size() + 1 treaps.
+    void split_many(
+        node_index root,
+        const std::vector<int> &cuts,
+        std::vector<node_index> &pieces);
 
     // Function insert - insert new element into array by its position.
-    // Parameter node *&root - pointer to the treap,
+    // Parameter node_index &root - index of the treap,
     // where should be stored the result of inserting.
-    // Parameter node *item - node to insert.
+    // Parameter node_index item - node to insert.
     // Parameter const int position - position in the array.
-    void insert(node *&root, node *item, const int position);
+    void insert(node_index &root, node_index item, const int position);
 
     // Function reorder - move subsegment to the start of the array.
-    // Parameter node *root - pointer to the treap.
+    // Parameter node_index root - index of the treap.
     // Parameter const int left - left position in the array.
     // Parameter const int right - right position in the array.
-    // Return node* - pointer to the result of moving.
-    node* reorder(node *root, const int left, const int right);
+    // Return node_index - index of the result of moving.
+    node_index reorder(node_index root, const int left, const int right);
 
-    // Function get_elements - insert elements from the node to the list.
-    // Parameter node *root - pointer to the treap.
-    // Parameter std::vector<int> &elements - list, where elements should be stored.
-    void get_elements(node *root, std::vector<int> &elements);
+    // Function reverse - reverse order of the elements in subsegment.
+    // Parameter node_index root - index of the treap.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Return node_index - index of the result of reversing.
+    node_index reverse(node_index root, const int left, const int right);
 
-    // Function get_description - get description of the node - print array.
-    // Parameter node *root - treap to print.
-    // Return std::string - description of the array.
-    std::string get_description(node *root);
+    // Function move_to - move subsegment to the given position.
+    // Parameter node_index root - index of the treap.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Parameter const int position - position of the first moved element
+    // in the resulting array.
+    // Return node_index - index of the result of moving.
+    node_index move_to(
+        node_index root,
+        const int left,
+        const int right,
+        const int position);
+
+    // Function rotate - cyclic shift of subsegment to the left.
+    // Parameter node_index root - index of the treap.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Parameter const int shift - number of positions to shift.
+    // Return node_index - index of the result of shifting.
+    node_index rotate(
+        node_index root,
+        const int left,
+        const int right,
+        const int shift);
+
+    // Function get_elements - write elements from the node to the list.
+    // Uses explicit stack instead of recursion.
+    // Parameter node_index root - index of the treap.
+    // Parameter T *elements - place in the list for the first element of the treap.
+    void get_elements(node_index root, T *elements);
+
+    // Function get_tasks - cut the treap into subtrees that can be retrieved separately.
+    // Elements of the nodes above the subtrees are written to the list.
+    // Parameter node_index root - index of the treap.
+    // Parameter T *elements - place in the list for the first element of the treap.
+    // Parameter const int task_size - maximal size of the subtree.
+    // Parameter std::vector<std::pair<node_index, int> > &tasks - list of subtrees
+    // with the places of their first elements in the list.
+    void get_tasks(
+        node_index root,
+        T *elements,
+        const int task_size,
+        std::vector<std::pair<node_index, int> > &tasks);
+
+    // Function depth_stats - collect depths of the nodes in the treap.
+    // Uses explicit stack instead of recursion.
+    // Parameter node_index root - index of the treap.
+    // Parameter int &max_depth - maximum depth of the node.
+    // Parameter long long &total_depth - sum of depths of the nodes.
+    void depth_stats(node_index root, int &max_depth, long long &total_depth);
 };
 
-// Struct query.
-// Used for describing the given query with left and right indexes.
-struct query {
+// Type treap - treap of integers without aggregate.
+typedef basic_treap<int> treap;
+
+// Struct basic_path_copying_treap.
+// Split and merge of the implicit treap that copy the nodes on their path
+// instead of changing them, shared by the persistent and the concurrent treaps.
+// Storage of the nodes is given by Derived through the functions
+// node &at(node_index), node_index allocate() and node_index own(node_index),
+// own returns the node itself if it can be changed, its copy otherwise.
+template <typename Derived, typename T>
+struct basic_path_copying_treap {
+protected:
+    // Type node_index - index of the node in the pool, 0 means no node.
+    typedef std::uint32_t node_index;
+
+    // Path-copying treap node structure.
+    struct node {
+        // Field value - value that the node stores.
+        T value;
+
+        // Field size - number of childs in the node.
+        int size;
+
+        // Field priority - random key, treap is a max-heap by this key.
+        std::uint32_t priority;
+
+        // Index of the left child.
+        node_index left;
+
+        // Index of the right child.
+        node_index right;
+
+        // Initialization.
+        node();
+
+        // Initialization with given value and priority.
+        node(const T &value, const std::uint32_t priority);
+    };
+
+    // Function build - create new treap in linear time as a cartesian tree.
+    // Sentinel node with size 0 is allocated first.
+    // Parameter std::vector<T> &values - elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    // Return node_index - index of the created treap.
+    node_index build(std::vector<T> &values, const std::uint64_t seed);
+
+    // Function link - attach the treap to the node.
+    // Parameter node_index owner - node to attach to, 0 means the result itself.
+    // Parameter const bool to_right - attach as the right child.
+    // Parameter node_index child - treap to attach.
+    // Parameter node_index &result - where the treap is stored if there is no owner.
+    void link(node_index owner, const bool to_right, node_index child, node_index &result);
+
+    // Function merge - merge two treaps into new one, copying the nodes on the path.
+    // Parameter node_index left - index of the first treap.
+    // Parameter node_index right - index of the second treap.
+    // Parameter node_index &result - node where should be stored the result of the merging.
+    void merge(node_index left, node_index right, node_index &result);
+
+    // Function split - split treap into two treaps by position in the array,
+    // copying the nodes on the path.
+    // Parameter node_index root - index of the treap that should be split.
+    // Parameter node_index &left - node where should be stored the first treap.
+    // Parameter node_index &right - node where should be stored the second treap.
+    // Parameter const int position - position in the array.
+    void split(node_index root, node_index &left, node_index &right, const int position);
+
+private:
+    // Function storage - get the treap that stores the nodes.
+    // Return Derived & - the treap itself.
+    Derived &storage();
+};
+
+// Struct basic_persistent_treap.
+// Implicit treap where operations do not change existing nodes:
+// split and merge copy the nodes on their path, so every previous version
+// of the array stays available and takes O(log n) new nodes.
+// Version is the index of its root, so it is stored and copied in O(1).
+// Nodes of the versions that are not needed any more are released
+// together by collect.
+template <typename T>
+struct basic_persistent_treap
+    : basic_path_copying_treap<basic_persistent_treap<T>, T> {
 public:
-    // Field int left_position - left index.
-    int left_position;
+    // Type version - handle of the version of the array.
+    typedef std::uint32_t version;
 
-    // Field int right_position - right index.
-    int right_position;
+    // Initialization - create new treap with elements from 1 up to size.
+    // Parameter const int size - number of elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit basic_persistent_treap(
+        const int size,
+        const std::uint64_t seed = default_seed);
 
-    // Default initialization that gives indexes value 0.
-    query();
+    // Initialization - create new treap.
+    // Parameter std::vector<T> &values - elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit basic_persistent_treap(
+        std::vector<T> &values,
+        const std::uint64_t seed = default_seed);
 
-    // Initialization with given indexes.
-    query(const int left, const int right);
+    // Function get_initial_version - get version that was created by initialization.
+    // Return version - initial version.
+    version get_initial_version();
+
+    // Function reorder - move subsegment to the start of the array.
+    // Given version is not changed.
+    // Parameter const version source - version of the array.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    // Return version - version of the array after moving.
+    version reorder(const version source, const int left, const int right);
+
+    // Function get_elements - retrieve elements of the version in the correct order.
+    // Parameter const version source - version of the array.
+    // Return std::vector<T> - list of elements.
+    std::vector<T> get_elements(const version source);
+
+    // Function size - find number of elements in the version.
+    // Parameter const version source - version of the array.
+    // Return int - number of elements.
+    int size(const version source);
+
+    // Function nodes_count - find number of nodes in the pool, including released ones.
+    // Return std::size_t - number of nodes.
+    std::size_t nodes_count();
+
+    // Function collect - release all versions except the given ones and the initial one.
+    // Nodes of the kept versions are copied to the new pool, so the handles are rewritten.
+    // Parameter std::vector<version> &versions - versions to keep.
+    void collect(std::vector<version> &versions);
+
+private:
+    friend struct basic_path_copying_treap<basic_persistent_treap, T>;
+
+    // Type base - split and merge of the treap.
+    typedef basic_path_copying_treap<basic_persistent_treap, T> base;
+
+    // Type node_index - index of the node in the pool, 0 means no node.
+    typedef typename base::node_index node_index;
+
+    // Type node - node of the treap.
+    typedef typename base::node node;
+
+    using base::merge;
+    using base::split;
+
+    // Pool of the nodes, node with index 0 is a sentinel with size 0.
+    std::vector<node> nodes;
+
+    // Field initial_version - root of the initial array.
+    version initial_version;
+
+    // Field first_own_node - nodes from this index were created by the current operation,
+    // no version refers to them yet, so they are changed without copying.
+    node_index first_own_node;
+
+    // Function at - get node by index.
+    // Parameter const node_index index - index of the node.
+    // Return node & - the node.
+    node &at(const node_index index);
+
+    // Function allocate - add new node to the pool.
+    // Return node_index - index of the node.
+    node_index allocate();
+
+    // Function build - create new treap in linear time as a cartesian tree.
+    // Parameter std::vector<T> &values - elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    // Return node_index - index of the created treap.
+    node_index build(std::vector<T> &values, const std::uint64_t seed);
+
+    // Function own - get node that can be changed by the current operation.
+    // Parameter node_index root - index of the node.
+    // Return node_index - the node itself if it was created by the current operation,
+    // its copy otherwise.
+    node_index own(node_index root);
 };
 
-// Function solve - solve given problem.
-// Parameter const int size - number of elements in the array.
-// Parameter const int queries_count - number of queries.
-// Parameter std::vector<query> &queries - list of queries,
-// that contains left and right indexes of each query.
-// Return std::vector<int> - elements after processing queries.
-std::vector<int> solve(
-    const int size,
-    const int queries_count,
-    std::vector<query> &queries);
+// Type persistent_treap - persistent treap of integers.
+typedef basic_persistent_treap<int> persistent_treap;
 
-// Function read_data - process input.
-// Parameter std::istream &_Istr - input stream.
-// Parameter const int size - number of elements in the array.
-// Parameter const int queries_count - number of queries.
-// Parameter std::vector<query> &queries - list of queries,
-// that contains left and right indexes of each query.
-void read_data(
-    std::istream &_Istr,
-    int &size,
-    int &queries_count,
-    std::vector<query> &queries);
+// Struct basic_concurrent_treap.
+// Implicit treap for one writer and many concurrent readers.
+// Writer copies the nodes on the path of every change and publishes the new root atomically,
+// published nodes are never changed and their storage is never moved.
+// Readers take wait-free snapshots, replaced nodes are reused only after
+// every reader that could see them has left its snapshot (epoch-based reclamation).
+template <typename T>
+struct basic_concurrent_treap
+    : basic_path_copying_treap<basic_concurrent_treap<T>, T> {
+private:
+    friend struct basic_path_copying_treap<basic_concurrent_treap, T>;
 
-// Function write_data - process output.
-// Parameter std::ostream &_Ostr - output stream.
-// Parameter std::vector<int> &data - list of integer data to write.
-void write_data(
-    std::ostream &_Ostr,
-    std::vector<int> &data);
+    // Type base - split and merge of the treap.
+    typedef basic_path_copying_treap<basic_concurrent_treap, T> base;
 
-// Main function.
-int main();
+    // Type node_index - index of the node in the pool, 0 means no node.
+    typedef typename base::node_index node_index;
+
+    // Type node - node of the treap.
+    typedef typename base::node node;
+
+    using base::merge;
+    using base::split;
+
+public:
+    // Maximal number of attached readers.
+    static const int max_readers = 128;
+
+    // Struct snapshot.
+    // Version of the array that is kept alive while the snapshot exists.
+    // Used only by the thread of the reader it was taken by.
+    struct snapshot {
+    public:
+        // Initialization - take the latest published version.
+        // Parameter basic_concurrent_treap &tree - treap to read.
+        // Parameter const int reader - reader given by attach_reader,
+        // it holds at most one snapshot at a time.
+        snapshot(basic_concurrent_treap &tree, const int reader);
+
+        // Destruction - allow reclamation of the nodes of the version.
+        ~snapshot();
+
+        // Function size - find number of elements in the version.
+        // Return int - number of elements.
+        int size() const;
+
+        // Function get_elements - retrieve elements of the version in the correct order.
+        // Return std::vector<T> - list of elements.
+        std::vector<T> get_elements() const;
+
+        // Function get_elements - retrieve elements of the subsegment in the correct order.
+        // Parameter const int left - left position in the array.
+        // Parameter const int right - right position in the array.
+        // Return std::vector<T> - list of elements.
+        std::vector<T> get_elements(const int left, const int right) const;
+
+        // Function get_description - get elements of the version, separated by the separator.
+        // Parameter const std::string separator - separator between the elements.
+        // Return std::string - elements of the version.
+        std::string get_description(const std::string separator = " ") const;
+
+    private:
+        // Field const basic_concurrent_treap &tree - treap the snapshot is taken of.
+        const basic_concurrent_treap &tree;
+
+        // Field const int reader - reader that holds the snapshot.
+        const int reader;
+
+        // Field node_index root - root of the version.
+        node_index root;
+
+        snapshot(const snapshot &) = delete;
+        snapshot &operator=(const snapshot &) = delete;
+    };
+
+    // Initialization - create new treap with elements from 1 up to size.
+    // Parameter const int size - number of elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit basic_concurrent_treap(
+        const int size,
+        const std::uint64_t seed = default_seed);
+
+    // Initialization - create new treap.
+    // Parameter std::vector<T> &values - elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit basic_concurrent_treap(
+        std::vector<T> &values,
+        const std::uint64_t seed = default_seed);
+
+    // Function attach_reader - register the reading thread.
+    // Return int - reader to take snapshots with.
+    // Throws std::runtime_error if max_readers readers are attached.
+    int attach_reader();
+
+    // Function detach_reader - release the reader, it must not hold a snapshot.
+    // Parameter const int reader - reader given by attach_reader.
+    void detach_reader(const int reader);
+
+    // Function reorder - move subsegment to the start of the array and publish new version.
+    // Called only by the writer.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    void reorder(const int left, const int right);
+
+    // Function nodes_count - find number of nodes in the pool, including free ones.
+    // Return std::size_t - number of nodes.
+    std::size_t nodes_count();
+
+private:
+    // Number of nodes in one chunk of the pool is 2 ^ chunk_bits.
+    static const int chunk_bits = 16;
+
+    // Maximal number of chunks in the pool.
+    static const int max_chunks = 1 << (32 - chunk_bits);
+
+    // Struct reader_slot.
+    // State of one reader, padded to its own cache line.
+    struct reader_slot {
+        // Field std::atomic<std::uint64_t> epoch - epoch of the held snapshot, 0 if none.
+        std::atomic<std::uint64_t> epoch;
+
+        // Field std::atomic<bool> attached - the slot is given to a reader.
+        std::atomic<bool> attached;
+
+        // Padding up to 64 bytes.
+        char padding[64 - sizeof(std::atomic<std::uint64_t>) - sizeof(std::atomic<bool>)];
+    };
+
+    // Struct retired_node.
+    // Node that was replaced by the writer.
+    struct retired_node {
+        // Field std::uint64_t epoch - epoch when the node was replaced.
+        std::uint64_t epoch;
+
+        // Field node_index index - index of the node.
+        node_index index;
+    };
+
+    // Chunks of the pool, node with index 0 is a sentinel with size 0.
+    std::unique_ptr<std::unique_ptr<node[]>[]> chunks;
+
+    // Field std::size_t allocated - number of nodes in the pool.
+    std::size_t allocated;
+
+    // Field std::atomic<node_index> root - root of the latest published version.
+    std::atomic<node_index> root;
+
+    // Field std::atomic<std::uint64_t> epoch - current epoch, increased after every publication.
+    std::atomic<std::uint64_t> epoch;
+
+    // Field readers - states of the readers.
+    std::unique_ptr<reader_slot[]> readers;
+
+    // Field std::vector<std::uint64_t> owner - number of the change that created the node,
+    // used only by the writer.
+    std::vector<std::uint64_t> owner;
+
+    // Field std::uint64_t change - number of the current change.
+    std::uint64_t change;
+
+    // Field std::vector<node_index> free_nodes - nodes that can be reused.
+    std::vector<node_index> free_nodes;
+
+    // Field std::vector<node_index> replaced - nodes replaced by the current change.
+    std::vector<node_index> replaced;
+
+    // Field std::deque<retired_node> retired - replaced nodes waiting for the readers.
+    std::deque<retired_node> retired;
+
+    // Function at - get node by index.
+    // Parameter const node_index index - index of the node.
+    // Return node & - the node.
+    node &at(const node_index index);
+
+    // Function at - get node by index.
+    // Parameter const node_index index - index of the node.
+    // Return const node & - the node.
+    const node &at(const node_index index) const;
+
+    // Function size - find number of elements in the subtree.
+    // Parameter const node_index index - index of the subtree.
+    // Return int - number of elements.
+    int size(const node_index index) const;
+
+    // Function allocate - get unused node, from the free nodes if possible.
+    // Return node_index - index of the node.
+    node_index allocate();
+
+    // Function build - create new treap in linear time as a cartesian tree.
+    // Parameter std::vector<T> &values - elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    // Return node_index - index of the created treap.
+    node_index build(std::vector<T> &values, const std::uint64_t seed);
+
+    // Function own - get node that can be changed by the current change.
+    // Parameter node_index index - index of the node.
+    // Return node_index - the node itself if it was created by the current change,
+    // its copy otherwise.
+    node_index own(node_index index);
+
+    // Function reclaim - free retired nodes that no reader can see.
+    void reclaim();
+};
+
+// Type concurrent_treap - concurrent treap of integers.
+typedef basic_concurrent_treap<int> concurrent_treap;
+
+// Struct basic_bplus_tree.
+// Implicit B+-tree with the same reorder and get_elements as the treap.
+// Elements are packed into arrays of the leaves of leaf_bytes bytes,
+// inner nodes keep the number of elements of every child, all leaves have the same depth.
+// Every node except the root is at least half full.
+// Subsegments are cut and joined along one path, moving elements inside the nodes
+// with memmove, so one reorder touches O(log n) nodes that are mostly in cache.
+// Elements must be trivially copyable.
+template <typename T>
+struct basic_bplus_tree {
+public:
+    // Size of the leaf in bytes, a multiple of the cache line.
+    static const int leaf_bytes = 512;
+
+    // Maximal number of elements in the leaf.
+    static const int leaf_capacity = (leaf_bytes - sizeof(int)) / sizeof(T);
+
+    // Maximal number of children of the inner node.
+    static const int inner_capacity = 32;
+
+    // Initialization - create new tree with elements from 1 up to size.
+    // Parameter const int size - number of elements in the array.
+    explicit basic_bplus_tree(const int size);
+
+    // Initialization - create new tree.
+    // Parameter std::vector<T> &values - elements in the array.
+    explicit basic_bplus_tree(std::vector<T> &values);
+
+    // Function reorder - move subsegment to the start of the array.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    void reorder(const int left, const int right);
+
+    // Function get_elements - retrieve elements from the tree in the correct order.
+    // Return std::vector<T> - list of elements.
+    std::vector<T> get_elements();
+
+    // Function for_each - call the function for every element in the correct order.
+    // Parameter Function function - function that takes const T &.
+    template <typename Function>
+    void for_each(Function function);
+
+    // Function size - find number of elements in the array.
+    // Return int - number of elements.
+    int size();
+
+    // Function height - find number of levels of inner nodes above the leaves.
+    // Return int - height of the tree.
+    int height();
+
+private:
+    // Type node_index - index of the node in its pool, 0 means no node.
+    typedef std::uint32_t node_index;
+
+    // Struct leaf.
+    // Leaf of the tree with packed elements.
+    struct leaf {
+        // Field count - number of elements in the leaf.
+        int count;
+
+        // Field values - elements of the leaf.
+        T values[leaf_capacity];
+    };
+
+    // Struct inner.
+    // Inner node of the tree.
+    struct inner {
+        // Field count - number of children.
+        int count;
+
+        // Field sizes - number of elements in every child.
+        int sizes[inner_capacity];
+
+        // Field children - indices of the children, leaves if the node has height 1.
+        node_index children[inner_capacity];
+    };
+
+    // Struct part.
+    // Tree that is stored in the pools, used while the array is cut and joined.
+    struct part {
+        // Field root - index of the root.
+        node_index root;
+
+        // Field height - height of the root, 0 if the root is a leaf.
+        int height;
+
+        // Field size - number of elements, 0 if the tree is empty.
+        int size;
+    };
+
+    // Pool of the leaves, leaf with index 0 is not used.
+    std::vector<leaf> leaves;
+
+    // Pool of the inner nodes, node with index 0 is not used.
+    std::vector<inner> inners;
+
+    // Field free_leaves - released leaves that can be reused.
+    std::vector<node_index> free_leaves;
+
+    // Field free_inners - released inner nodes that can be reused.
+    std::vector<node_index> free_inners;
+
+    // Field tree - the whole array.
+    part tree;
+
+    // Field path - nodes on the path from the root, used by join.
+    std::vector<node_index> path;
+
+    // Field left_parts - parts of the first tree cut by split, from the root down.
+    std::vector<part> left_parts;
+
+    // Field right_parts - parts of the second tree cut by split, from the root down.
+    std::vector<part> right_parts;
+
+    // Function allocate_leaf - get unused leaf.
+    // Return node_index - index of the leaf.
+    node_index allocate_leaf();
+
+    // Function allocate_inner - get unused inner node.
+    // Return node_index - index of the node.
+    node_index allocate_inner();
+
+    // Function node_size - find number of elements in the subtree.
+    // Parameter const node_index index - index of the node.
+    // Parameter const int height - height of the node.
+    // Return int - number of elements.
+    int node_size(const node_index index, const int height);
+
+    // Function build - create the tree with evenly filled nodes.
+    // Parameter std::vector<T> &values - elements in the array.
+    void build(std::vector<T> &values);
+
+    // Function split - cut the tree into two trees by position in the array.
+    // Parameter const part source - tree that should be split.
+    // Parameter const int position - number of elements in the first tree.
+    // Parameter part &left - first tree.
+    // Parameter part &right - second tree.
+    void split(const part source, const int position, part &left, part &right);
+
+    // Function join - concatenate two trees.
+    // Parameter part left - first tree.
+    // Parameter part right - second tree.
+    // Return part - tree with elements of the first tree followed by the second one.
+    part join(part left, part right);
+
+    // Function combine - merge two neighbouring nodes of the same height,
+    // or move elements between them so both are at least half full if they do not fit into one.
+    // Parameter const node_index left - first node.
+    // Parameter const node_index right - second node.
+    // Parameter const int height - height of the nodes.
+    // Return node_index - second node, 0 if it was merged into the first one.
+    node_index combine(const node_index left, const node_index right, const int height);
+
+    // Function insert_child - insert child into the inner node, splitting the node if it is full.
+    // Parameter const node_index index - index of the node.
+    // Parameter const int position - position of the new child.
+    // Parameter const node_index child - index of the child.
+    // Parameter const int child_size - number of elements of the child.
+    // Return node_index - new node with the second half of the children, 0 if node was not split.
+    node_index insert_child(
+        const node_index index,
+        const int position,
+        const node_index child,
+        const int child_size);
+
+    // Function get_elements - copy elements of the subtree to the list.
+    // Parameter const node_index index - index of the node.
+    // Parameter const int height - height of the node.
+    // Parameter T *&elements - where the elements are written, moved past them.
+    void get_elements(const node_index index, const int height, T *&elements);
+
+    // Function for_each - call the function for every element of the subtree.
+    // Parameter const node_index index - index of the node.
+    // Parameter const int height - height of the node.
+    // Parameter Function &function - function that takes const T &.
+    template <typename Function>
+    void for_each(const node_index index, const int height, Function &function);
+};
+
+// Type bplus_tree - B+ tree of integers.
+typedef basic_bplus_tree<int> bplus_tree;
+
+// Struct basic_flat_array.
+// Array with the same reorder and get_elements as the treap, stored as a plain list.
+// Reorder is a rotation of the prefix made by memcpy of the shorter part to the buffer
+// and memmove of the longer one, so it takes O(right) with a tiny constant
+// and beats the treap on small arrays. Elements must be trivially copyable.
+template <typename T>
+struct basic_flat_array {
+public:
+    // Initialization - create new array with elements from 1 up to size.
+    // Parameter const int size - number of elements in the array.
+    explicit basic_flat_array(const int size);
+
+    // Function assign - replace all elements with elements from 1 up to size, keeping the memory.
+    // Parameter const int size - number of elements in the array.
+    void assign(const int size);
+
+    // Function reorder - move subsegment to the start of the array.
+    // Subsegment must satisfy 1 <= left <= right <= size, other subsegments are ignored.
+    // Parameter const int left - left position in the array.
+    // Parameter const int right - right position in the array.
+    void reorder(const int left, const int right);
+
+    // Function get_elements - retrieve elements in the correct order.
+    // Return std::vector<T> - list of elements.
+    std::vector<T> get_elements();
+
+    // Function for_each - call the function for every element in the correct order.
+    // Parameter Function function - function that takes const T &.
+    template <typename Function>
+    void for_each(Function function);
+
+private:
+    // Field elements - elements of the array.
+    std::vector<T> elements;
+
+    // Field buffer - shorter part of the rotated prefix.
+    std::vector<T> buffer;
+};
+
+// Type flat_array - flat array of integers.
+typedef basic_flat_array<int> flat_array;
+
+// Struct run_treap.
+// Implicit treap over the array that starts as 1..n and is changed only by reorder,
+// so it is always a concatenation of increasing runs of consecutive values.
+// Every node stores one run, a run is cut in two when a split falls inside it,
+// so memory and time depend on the number of queries, not on n.
+// Sizes are 64-bit, so n may be in the billions.
+struct run_treap {
+public:
+    // Initialization - create new treap with elements from 1 up to size.
+    // Parameter const long long size - number of elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    explicit run_treap(const long long size, const std::uint64_t seed = default_seed);
+
+    // Function assign - replace all elements with elements from 1 up to size.
+    // Parameter const long long size - number of elements in the array.
+    // Parameter const std::uint64_t seed - seed of the node priorities.
+    void assign(const long long size, const std::uint64_t seed = default_seed);
+
+    // Function reorder - move subsegment to the start of the array.
+    // Parameter const long long left - left position in the array.
+    // Parameter const long long right - right position in the array.
+    void reorder(const long long left, const long long right);
+
+    // Function get_elements - retrieve elements from the treap in the correct order.
+    // Return std::vector<long long> - list of elements.
+    std::vector<long long> get_elements();
+
+    // Function for_each_run - call the function for every run in the correct order.
+    // Parameter Function function - function that takes first value and length of the run.
+    template <typename Function>
+    void for_each_run(Function function);
+
+    // Function size - find number of elements in the array.
+    // Return long long - number of elements.
+    long long size();
+
+    // Function runs_count - find number of runs, that is number of nodes.
+    // Return std::size_t - number of runs.
+    std::size_t runs_count();
+
+private:
+    // Type node_index - index of the node in the pool, 0 means no node.
+    typedef std::uint32_t node_index;
+
+    // Run treap node structure.
+    struct node {
+        // Field start - first value of the run.
+        long long start;
+
+        // Field length - number of values in the run.
+        long long length;
+
+        // Field size - number of elements in the subtree.
+        long long size;
+
+        // Field priority - random key, treap is a max-heap by this key.
+        std::uint32_t priority;
+
+        // Index of the left child.
+        node_index left;
+
+        // Index of the right child.
+        node_index right;
+    };
+
+    // Pool of the nodes, node with index 0 is a sentinel with size 0.
+    std::vector<node> nodes;
+
+    // Index of the root node.
+    node_index root;
+
+    // Field priority_state - state of the generator of the node priorities.
+    std::uint64_t priority_state;
+
+    // Field path - nodes on the path to the run that is cut.
+    std::vector<node_index> path;
+
+    // Function create_node - add new node with the run.
+    // Parameter const long long start - first value of the run.
+    // Parameter const long long length - number of values in the run.
+    // Return node_index - index of the node.
+    node_index create_node(const long long start, const long long length);
+
+    // Function size - find number of elements in the subtree.
+    // Parameter const node_index index - index of the subtree.
+    // Return long long - number of elements.
+    long long size(const node_index index);
+
+    // Function cut - make the position a border between runs.
+    // If the position is inside a run, its end becomes a new node
+    // that is inserted with its own random priority.
+    // Parameter const long long position - number of elements before the border.
+    void cut(const long long position);
+
+    // Function merge - merge two treaps into new one.
+    // Parameter node_index left - index of the first treap.
+    // Parameter node_index right - index of the second treap.
+    // Parameter node_index &result - node where should be stored the result of the merging.
+    void merge(node_index left, node_index right, node_index &result);
+
+    // Function split - split treap into two treaps by the border between runs.
+    // Parameter node_index root - index of the treap that should be split.
+    // Parameter node_index &left - node where should be stored the first treap.
+    // Parameter node_index &right - node where should be stored the second treap.
+    // Parameter const long long position - number of elements in the first treap,
+    // it must be a border between runs.
+    void split(node_index root, node_index &left, node_index &right, const long long position);
+};
+
+// Struct query.
+// Used for describing the given query with left and right indexes.
+struct query {
+public:
+    // Field int left_position - left index.
+    int left_position;
+
+    // Field int right_position - right index.
+    int right_position;
+
+    // Default initialization that gives indexes value 0.
+    query();
+
+    // Initialization with given indexes.
+    query(const int left, const int right);
+};
+
+// Function fuse_queries - rewrite list of queries into shorter equivalent one.
+// Query (left, right) is a cyclic shift of the prefix [1, right] by left - 1 positions,
+// so queries with left = 1 change nothing and consecutive queries with the same right
+// position are one shift by the sum of their shifts.
+// Queries with left < 1 or left > right are kept as they are.
+// Moves of adjacent ranges one after another are not fused: the result of two
+// prefix rotations with different right positions is not a prefix rotation,
+// so it can not be written as one query.
+// Fusion is done by query_fuser, so it is the same as in the streaming solvers.
+// Parameter std::vector<query> &queries - list of queries, it is rewritten in place.
+// Return int - number of removed queries.
+int fuse_queries(std::vector<query> &queries);
+
+// Struct query_fuser.
+// Fuses queries one by one as they come, by the rules of fuse_queries.
+// Fused queries are kept as a stack: the query that becomes empty is removed,
+// so the queries around it can be fused too.
+// When the stack reaches max_pending queries, its older half is applied to the engine,
+// so memory does not depend on the number of queries.
+struct query_fuser {
+public:
+    // Maximal number of fused queries that are kept before applying.
+    static const int max_pending = 1 << 16;
+
+    // Initialization - fuser without queries.
+    query_fuser();
+
+    // Function push - add the query after all pushed ones.
+    // Parameter const long long left - left position of the query.
+    // Parameter const long long right - right position of the query.
+    // Parameter Engine &engine - array that takes the older queries if the stack is full.
+    template <typename Engine>
+    void push(const long long left, const long long right, Engine &engine);
+
+    // Function flush - apply all kept queries to the array.
+    // Parameter Engine &engine - array to apply the queries to.
+    template <typename Engine>
+    void flush(Engine &engine);
+
+    // Function get_queries_count - find number of pushed queries.
+    // Return int - number of queries.
+    int get_queries_count() const;
+
+    // Function get_removed_count - find number of pushed queries that were not applied,
+    // final after flush.
+    // Return int - number of removed queries.
+    int get_removed_count() const;
+
+private:
+    // Struct pending_query.
+    // Fused query that is not applied yet.
+    struct pending_query {
+        // Field long long left - left position of the query.
+        long long left;
+
+        // Field long long right - right position of the query.
+        long long right;
+    };
+
+    // Field std::vector<pending_query> pending - stack of the fused queries.
+    std::vector<pending_query> pending;
+
+    // Field int queries_count - number of pushed queries.
+    int queries_count;
+
+    // Field int applied_count - number of queries applied to the engine.
+    int applied_count;
+
+    // Function apply - apply the oldest kept queries and remove them from the stack.
+    // Parameter Engine &engine - array to apply the queries to.
+    // Parameter const std::size_t count - number of queries.
+    template <typename Engine>
+    void apply(Engine &engine, const std::size_t count);
+};
+
+// Maximal number of elements that solve keeps in flat_array instead of the treap.
+// Rotation by memmove wins below it on every benchmark workload, the treap wins above.
+// Queries outside the array always go to the treap, so the result does not depend on the engine.
+const int flat_array_threshold = 1 << 13;
+
+// Function solve - solve given problem.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query; first queries_count of them
+// are used and the list is not changed.
+// Return std::vector<int> - elements after processing queries.
+std::vector<int> solve(
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries);
+
+// Function solve - solve given problem reusing the treap.
+// Small arrays are solved by flat_array (see flat_array_threshold).
+// Parameter treap &tree - treap that is rebuilt for the problem, its memory is reused.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query; first queries_count of them
+// are used and the list is not changed.
+// Return std::vector<int> - elements after processing queries.
+std::vector<int> solve(
+    treap &tree,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries);
+
+// Function read_data - process input.
+// Parameter std::istream &_Istr - input stream.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query.
+void read_data(
+    std::istream &_Istr,
+    int &size,
+    int &queries_count,
+    std::vector<query> &queries);
+
+// Struct mapped_file.
+// Read-only view of the whole file. File is memory-mapped,
+// or read to memory where mapping is not available.
+struct mapped_file {
+public:
+    // Initialization - map the file.
+    // Parameter const std::string &path - path to the file.
+    // Throws std::runtime_error if file can not be opened.
+    explicit mapped_file(const std::string &path);
+
+    // Release the mapping.
+    ~mapped_file();
+
+    // Function data - get contents of the file.
+    // Return const char* - pointer to the first byte.
+    const char *data() const;
+
+    // Function size - get size of the file.
+    // Return std::size_t - number of bytes.
+    std::size_t size() const;
+
+private:
+    // Field mapping - memory-mapped file, nullptr if file is not mapped.
+    char *mapping;
+
+    // Field mapping_size - size of the file.
+    std::size_t mapping_size;
+
+    // Field buffer - contents of the file if it is not mapped.
+    std::vector<char> buffer;
+
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+};
+
+// Struct input_reader.
+// Used for fast reading of integers from the file descriptor.
+// Regular files are memory-mapped and parsed in place,
+// other descriptors (pipes, terminals) are read by large blocks.
+struct input_reader {
+public:
+    // Size of the block for descriptors that can not be mapped.
+    static const int buffer_size = 1 << 20;
+
+    // Initialization - read from the open descriptor, it is not closed by the reader.
+    // Parameter const int descriptor - file descriptor.
+    explicit input_reader(const int descriptor);
+
+    // Initialization - read from the file.
+    // Parameter const std::string &path - path to the file.
+    explicit input_reader(const std::string &path);
+
+    // Release the mapping and close the file opened by the reader.
+    ~input_reader();
+
+    // Function read_int - read next integer separated by whitespaces.
+    // Throws std::runtime_error if input is malformed or has ended.
+    // Return int - read integer.
+    int read_int();
+
+    // Function read_long - read next 64-bit integer separated by whitespaces.
+    // Throws std::runtime_error if input is malformed or has ended.
+    // Return long long - read integer.
+    long long read_long();
+
+private:
+    // Field descriptor - file descriptor of the input.
+    int descriptor;
+
+    // Field owns_descriptor - descriptor was opened by the reader.
+    bool owns_descriptor;
+
+    // Field mapping - memory-mapped file, nullptr if file is not mapped.
+    char *mapping;
+
+    // Field mapping_size - size of the mapped file.
+    std::size_t mapping_size;
+
+    // Field buffer - block of the input for descriptors that are not mapped.
+    std::vector<char> buffer;
+
+    // Field current - next unread character.
+    const char *current;
+
+    // Field end - character after the last available one.
+    const char *end;
+
+    // Field consumed - number of characters before the available ones.
+    long long consumed;
+
+    // Function open - map the input or prepare the buffer.
+    void open();
+
+    // Function refill - make next characters of the input available.
+    // Return bool - false if input has ended.
+    bool refill();
+
+    // Function read_integer - read next integer with absolute value up to the limit.
+    // Parameter const unsigned long long limit - maximal positive value,
+    // negative value may be one larger by absolute value.
+    // Throws std::runtime_error if input is malformed or has ended.
+    // Return long long - read integer.
+    long long read_integer(const unsigned long long limit);
+
+    // Function fail - throw error about the current position.
+    // Parameter const std::string &message - description of the error.
+    [[noreturn]] void fail(const std::string &message);
+
+    input_reader(const input_reader &) = delete;
+    input_reader &operator=(const input_reader &) = delete;
+};
+
+// Function read_data - process input.
+// Parameter input_reader &reader - input reader.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query.
+// Throws std::runtime_error if input is malformed or query is out of the array.
+void read_data(
+    input_reader &reader,
+    int &size,
+    int &queries_count,
+    std::vector<query> &queries);
+
+// Function read_query - read one query and check that it is inside the array.
+// Parameter input_reader &reader - input reader.
+// Parameter const int size - number of elements in the array.
+// Parameter const int index - number of the query, used in the error message.
+// Throws std::runtime_error if input is malformed or query is out of the array.
+// Return query - read query.
+query read_query(input_reader &reader, const int size, const int index);
+
+// Function solve_stream - solve given problem applying each query as soon as it is read.
+// Queries are fused by query_fuser, so at most query_fuser::max_pending of them
+// are kept in memory.
+// Parameter input_reader &reader - input reader.
+// Throws std::runtime_error if input is malformed.
+// Return std::vector<int> - elements after processing queries.
+std::vector<int> solve_stream(input_reader &reader);
+
+// Function solve_stream - solve given problem applying each query as soon as it is read.
+// Parameter input_reader &reader - input reader.
+// Parameter treap &tree - treap that is rebuilt for the problem and keeps the result.
+// Throws std::runtime_error if input is malformed.
+void solve_stream(input_reader &reader, treap &tree);
+
+// Function solve_runs - solve given problem on the run-compressed treap,
+// applying each query as soon as it is read.
+// Number of elements and positions may be 64-bit.
+// Parameter input_reader &reader - input reader.
+// Parameter run_treap &tree - treap that is rebuilt for the problem and keeps the result.
+// Throws std::runtime_error if input is malformed.
+void solve_runs(input_reader &reader, run_treap &tree);
+
+// Struct spsc_ring.
+// Lock-free bounded queue for one producer thread and one consumer thread.
+// Items are passed in batches, so the atomic counters are touched once per batch.
+template <typename T>
+struct spsc_ring {
+public:
+    // Initialization - create empty ring.
+    // Parameter const std::size_t capacity - minimal number of items, rounded up to a power of two.
+    explicit spsc_ring(const std::size_t capacity);
+
+    // Function write - add items, waiting for free space. Called only by the producer.
+    // Parameter const T *items - items to add.
+    // Parameter const std::size_t count - number of items.
+    // Return bool - false if the consumer cancelled reading, the rest of the items is dropped.
+    bool write(const T *items, const std::size_t count);
+
+    // Function read - take available items, waiting for at least one. Called only by the consumer.
+    // Parameter T *items - where the items are stored.
+    // Parameter const std::size_t count - maximal number of items.
+    // Return std::size_t - number of taken items, 0 if the producer closed the ring
+    // and all items were taken.
+    std::size_t read(T *items, const std::size_t count);
+
+    // Function close - tell the consumer that there will be no more items.
+    void close();
+
+    // Function cancel - tell the producer that items are not needed anymore.
+    void cancel();
+
+private:
+    // Field items - storage of the ring.
+    std::vector<T> items;
+
+    // Field mask - capacity minus one.
+    std::size_t mask;
+
+    // Field head - number of items taken by the consumer.
+    std::atomic<std::size_t> head;
+
+    // Padding, so the counters of the threads are in different cache lines.
+    char head_padding[64];
+
+    // Field tail - number of items added by the producer.
+    std::atomic<std::size_t> tail;
+
+    // Padding after the counter of the producer.
+    char tail_padding[64];
+
+    // Field closed - producer has finished.
+    std::atomic<bool> closed;
+
+    // Field cancelled - consumer has stopped.
+    std::atomic<bool> cancelled;
+};
+
+// Struct output_writer.
+// Used for fast writing of integers to the file descriptor or the stream.
+// Integers are formatted two digits at a time by the table into one buffer,
+// that is written by large blocks.
+struct output_writer {
+public:
+    // Size of the buffer.
+    static const int buffer_size = 1 << 20;
+
+    // Initialization - write to the open descriptor, it is not closed by the writer.
+    // Parameter const int descriptor - file descriptor.
+    explicit output_writer(const int descriptor);
+
+    // Initialization - write to the stream.
+    // Parameter std::ostream &_Ostr - output stream.
+    explicit output_writer(std::ostream &_Ostr);
+
+    // Write the rest of the buffer, errors are ignored.
+    ~output_writer();
+
+    // Function write_int - write integer.
+    // Parameter const long long value - integer to write.
+    void write_int(const long long value);
+
+    // Function write_char - write one character.
+    // Parameter const char symbol - character to write.
+    void write_char(const char symbol);
+
+    // Function write_string - write characters of the string.
+    // Parameter const std::string &text - string to write.
+    void write_string(const std::string &text);
+
+    // Function flush - write the buffer to the output.
+    // Throws std::runtime_error if output can not be written.
+    void flush();
+
+private:
+    // Field descriptor - file descriptor of the output, -1 if the stream is used.
+    int descriptor;
+
+    // Field stream - output stream, nullptr if the descriptor is used.
+    std::ostream *stream;
+
+    // Field buffer - characters that are not written yet.
+    std::vector<char> buffer;
+
+    // Field current - next free character of the buffer.
+    char *current;
+
+    output_writer(const output_writer &) = delete;
+    output_writer &operator=(const output_writer &) = delete;
+};
+
+// Struct formatted_tag.
+// std::true_type if values of T are written by output_writer::write_int,
+// that is T is an integral type that fits into long long.
+template <typename T>
+struct formatted_tag : std::integral_constant<bool,
+    std::is_integral<T>::value
+    && (std::is_signed<T>::value || sizeof(T) < sizeof(long long))> {
+};
+
+// Function write_value - write element of the array by the integer formatter.
+// Parameter output_writer &writer - output writer.
+// Parameter const T &value - element to write.
+template <typename T>
+void write_value(output_writer &writer, const T &value, std::true_type);
+
+// Function write_value - write element of the array by std::to_string.
+// Parameter output_writer &writer - output writer.
+// Parameter const T &value - element to write.
+template <typename T>
+void write_value(output_writer &writer, const T &value, std::false_type);
+
+// Function apply_queries - rebuild the treap and apply queries to it.
+// Parameter treap &tree - treap that is rebuilt for the problem, its memory is reused.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query; first queries_count of them
+// are used and the list is not changed.
+void apply_queries(
+    treap &tree,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries);
+
+// Function apply_queries - rebuild the flat array and apply queries to it.
+// Parameter flat_array &array - array that is rebuilt for the problem, its memory is reused.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query; first queries_count of them
+// are used and the list is not changed.
+void apply_queries(
+    flat_array &array,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries);
+
+// Function solve - solve given problem and write the result,
+// choosing flat_array for small arrays and the treap otherwise.
+// Parameter treap &tree - treap that is reused for large arrays.
+// Parameter flat_array &array - array that is reused for small arrays.
+// Parameter const int size - number of elements in the array.
+// Parameter const int queries_count - number of queries.
+// Parameter std::vector<query> &queries - list of queries,
+// that contains left and right indexes of each query; first queries_count of them
+// are used and the list is not changed.
+// Parameter output_writer &writer - output writer.
+void solve(
+    treap &tree,
+    flat_array &array,
+    const int size,
+    const int queries_count,
+    std::vector<query> &queries,
+    output_writer &writer);
+
+// Function write_data - process output.
+// Parameter std::ostream &_Ostr - output stream.
+// Parameter const std::vector<int> &data - list of integer data to write.
+void write_data(
+    std::ostream &_Ostr,
+    const std::vector<int> &data);
+
+// Function write_data - process output taking elements straight from the treap.
+// Parameter output_writer &writer - output writer.
+// Parameter treap &tree - treap with the elements.
+void write_data(
+    output_writer &writer,
+    treap &tree);
+
+// Function write_data - process output taking elements from the flat array.
+// Parameter output_writer &writer - output writer.
+// Parameter flat_array &array - array with the elements.
+void write_data(
+    output_writer &writer,
+    flat_array &array);
+
+// Function write_data - process output taking runs straight from the run-compressed treap.
+// Parameter output_writer &writer - output writer.
+// Parameter run_treap &tree - treap with the elements.
+void write_data(
+    output_writer &writer,
+    run_treap &tree);
+
+// Function solve_pipelined - solve given problem with reading, applying and writing overlapped.
+// Parser thread reads queries into a ring while this thread builds the treap
+// and applies them, fused as in solve_stream. Then another thread walks the treap
+// into a ring while this thread formats and writes the elements.
+// Parameter input_reader &reader - input reader.
+// Parameter treap &tree - treap that is rebuilt for the problem and keeps the result.
+// Parameter output_writer &writer - output writer.
+// Throws std::runtime_error if input is malformed.
+void solve_pipelined(input_reader &reader, treap &tree, output_writer &writer);
+
+// Struct batch_solver.
+// Solves independent inputs at the same time on a pool of threads.
+// Every thread keeps one treap and rebuilds it for each input.
+// Results are written in the order the inputs were added, one line per input.
+struct batch_solver {
+public:
+    // Maximal number of inputs waiting for a thread, per thread.
+    static const int pending_per_thread = 2;
+
+    // Initialization - start the threads.
+    // Parameter const int threads_count - number of threads.
+    // Parameter std::ostream &_Ostr - output stream for the results.
+    batch_solver(const int threads_count, std::ostream &_Ostr);
+
+    // Destruction - wait for all inputs.
+    ~batch_solver();
+
+    // Function add - add input that is read from the file by the thread that solves it.
+    // Blocks while too many inputs are waiting, writing finished results meanwhile.
+    // Parameter const std::string &path - file with the input.
+    void add(const std::string &path);
+
+    // Function add - add input that was already read.
+    // Parameter const int size - number of elements in the array.
+    // Parameter std::vector<query> &queries - list of queries, it is taken by the solver.
+    void add(const int size, std::vector<query> &queries);
+
+    // Function finish - wait for all inputs and write all results.
+    // Inputs that failed are reported to the standard error and give empty lines.
+    // Return int - number of failed inputs.
+    int finish();
+
+private:
+    // Struct task.
+    // Used for describing one input.
+    struct task {
+        // Field std::size_t index - number of the input.
+        std::size_t index;
+
+        // Field std::string path - file with the input, empty if the input was already read.
+        std::string path;
+
+        // Field int size - number of elements in the array.
+        int size;
+
+        // Field std::vector<query> queries - list of queries.
+        std::vector<query> queries;
+    };
+
+    // Field std::ostream &output - output stream for the results.
+    std::ostream &output;
+
+    // Field std::vector<std::thread> threads - threads of the pool.
+    std::vector<std::thread> threads;
+
+    // Field std::mutex lock - guards all fields below.
+    std::mutex lock;
+
+    // Field std::condition_variable changed - notified on every change of the fields below.
+    std::condition_variable changed;
+
+    // Field std::deque<task> pending - inputs waiting for a thread.
+    std::deque<task> pending;
+
+    // Field std::map<std::size_t, std::string> finished - results that are not written yet.
+    std::map<std::size_t, std::string> finished;
+
+    // Field std::size_t added - number of added inputs.
+    std::size_t added;
+
+    // Field std::size_t written - number of written results.
+    std::size_t written;
+
+    // Field int failed - number of failed inputs.
+    int failed;
+
+    // Field bool closed - no more inputs are added.
+    bool closed;
+
+    // Function push - add the task, waiting for a free place.
+    // Parameter task &current - the task, it is taken by the solver.
+    void push(task &current);
+
+    // Function work - solve tasks until the solver is closed.
+    void work();
+
+    // Function flush - write finished results that go next, the lock is released while writing.
+    // Parameter std::unique_lock<std::mutex> &guard - holder of the lock.
+    void flush(std::unique_lock<std::mutex> &guard);
+};
+
+// Function solve_batch - solve all inputs from the files at the same time.
+// Parameter const std::vector<std::string> &paths - files with the inputs.
+// Parameter const int threads_count - number of threads.
+// Parameter std::ostream &_Ostr - output stream, one line per input.
+// Return int - number of failed inputs.
+int solve_batch(
+    const std::vector<std::string> &paths,
+    const int threads_count,
+    std::ostream &_Ostr);
+
+// Function solve_batch - solve all inputs from the multi-case input at the same time.
+// Multi-case input is the number of inputs followed by the inputs.
+// Parameter input_reader &reader - input reader.
+// Parameter const int threads_count - number of threads.
+// Parameter std::ostream &_Ostr - output stream, one line per input.
+// Throws std::runtime_error if the multi-case input is malformed.
+// Return int - number of failed inputs.
+int solve_batch(
+    input_reader &reader,
+    const int threads_count,
+    std::ostream &_Ostr);
+
+// Main function.
+// Not compiled with TREAP_BENCHMARK, benchmark.cpp provides its own one.
+// Usage: main [--stream | --runs | --pipeline] [input_file]
+//        main --batch [--threads count] [input_file]...
+// Parameter --stream - apply queries while reading instead of storing them.
+// Parameter --pipeline - read, apply and write in different threads at the same time.
+// Parameter --runs - use the run-compressed treap, memory depends only on the number
+// of queries and the number of elements may be 64-bit.
+// Parameter --batch - solve many inputs at the same time, one output line per input;
+// without files standard input is read as multi-case input.
+// Parameter --threads - number of threads of the batch from 1 to 4096, all cores by default.
+// Parameter input_file - file with the input, standard input is read by default;
+// more than one file is allowed only with --batch.
+// Unknown options and invalid values are reported to standard error with exit code 1.
+int main(int argc, char *argv[]);
+
+
+template <typename T>
+typename sum_aggregate<T>::result_type sum_aggregate<T>::identity() {
+    return result_type();
+}
+
+template <typename T>
+typename sum_aggregate<T>::result_type sum_aggregate<T>::lift(const T &value) {
+    return value;
+}
+
+template <typename T>
+typename sum_aggregate<T>::result_type sum_aggregate<T>::combine(
+    const result_type &left,
+    const result_type &right) {
+
+    return left + right;
+}
+
+template <typename T>
+typename min_aggregate<T>::result_type min_aggregate<T>::identity() {
+    return std::numeric_limits<result_type>::max();
+}
+
+template <typename T>
+typename min_aggregate<T>::result_type min_aggregate<T>::lift(const T &value) {
+    return value;
+}
+
+template <typename T>
+typename min_aggregate<T>::result_type min_aggregate<T>::combine(
+    const result_type &left,
+    const result_type &right) {
+
+    return right < left ? right : left;
+}
+
+template <typename T>
+typename max_aggregate<T>::result_type max_aggregate<T>::identity() {
+    return std::numeric_limits<result_type>::lowest();
+}
+
+template <typename T>
+typename max_aggregate<T>::result_type max_aggregate<T>::lift(const T &value) {
+    return value;
+}
+
+template <typename T>
+typename max_aggregate<T>::result_type max_aggregate<T>::combine(
+    const result_type &left,
+    const result_type &right) {
+
+    return left < right ? right : left;
+}
+
+template <typename Aggregate>
+treap_summary<Aggregate>::treap_summary() : summary(Aggregate::identity()) {}
+
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate>::basic_treap(const int size, const std::uint64_t seed)
+    : priority_state(seed) {
+
+    std::vector<T> values(size);
+    for (int i = 0; i < size; ++i) {
+        values[i] = static_cast<T>(i + 1);
+    }
+    nodes.reserve(size + 1);
+    nodes.push_back(node());
+    root = build(values);
+}
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate>::basic_treap(std::vector<T> &values, const std::uint64_t seed)
+    : priority_state(seed) {
+
+    nodes.reserve(values.size() + 1);
+    nodes.push_back(node());
+    root = build(values);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::assign(const int size, const std::uint64_t seed) {
+    std::vector<T> values(size);
+    for (int i = 0; i < size; ++i) {
+        values[i] = static_cast<T>(i + 1);
+    }
+    nodes.clear();
+    path.clear();
+    value_index.clear();
+    changes_count = 0;
+    priority_state = seed;
+    nodes.reserve(size + 1);
+    nodes.push_back(node());
+    root = build(values);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::reorder(const int left, const int right) {
+    TREAP_START_TIMER(start);
+    root = reorder(root, left, right);
+    TREAP_RECORD_REORDER(start);
+    count_change();
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::reverse(const int left, const int right) {
+    root = reverse(root, left, right);
+    count_change();
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::move_to(
+    const int left,
+    const int right,
+    const int position) {
+
+    root = move_to(root, left, right, position);
+    count_change();
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::rotate(const int left, const int right, const int shift) {
+    root = rotate(root, left, right, shift);
+    count_change();
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::reorder_many(
+    const std::vector<int> &cuts,
+    const std::vector<int> &permutation) {
+
+    const int pieces_count = static_cast<int>(cuts.size()) + 1;
+    for (std::size_t i = 0; i < cuts.size(); ++i) {
+        if (cuts[i] < 0 || cuts[i] > size(root) || (i > 0 && cuts[i] < cuts[i - 1])) {
+            throw std::invalid_argument("cuts must be sorted positions in the array");
+        }
+    }
+    if (static_cast<int>(permutation.size()) != pieces_count) {
+        throw std::invalid_argument("permutation must contain every piece exactly once");
+    }
+    // List of the pieces is not filled yet, so it marks pieces that are used.
+    cut_pieces.assign(pieces_count, 0);
+    for (std::size_t i = 0; i < permutation.size(); ++i) {
+        if (permutation[i] < 0 || permutation[i] >= pieces_count || cut_pieces[permutation[i]]) {
+            throw std::invalid_argument("permutation must contain every piece exactly once");
+        }
+        cut_pieces[permutation[i]] = 1;
+    }
+
+    TREAP_START_TIMER(start);
+    split_many(root, cuts, cut_pieces);
+    root = 0;
+    for (int i = 0; i < pieces_count; ++i) {
+        merge(root, cut_pieces[permutation[i]], root);
+    }
+    TREAP_RECORD_REORDER(start);
+    count_change();
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::compact(const bool van_emde_boas) {
+    changes_count = 0;
+
+    std::vector<node_index> order;
+    order.reserve(nodes.size());
+    order.push_back(0);
+    if (van_emde_boas) {
+        // Lazy reversals are pushed first, so the layout sees children in their final order.
+        int height = 0;
+        std::vector<std::pair<node_index, int> > stack;
+        if (root) {
+            stack.push_back(std::make_pair(root, 1));
+        }
+        while (!stack.empty()) {
+            const node_index current = stack.back().first;
+            const int depth = stack.back().second;
+            stack.pop_back();
+            push(current);
+            if (depth > height) {
+                height = depth;
+            }
+            if (nodes[current].left) {
+                stack.push_back(std::make_pair(nodes[current].left, depth + 1));
+            }
+            if (nodes[current].right) {
+                stack.push_back(std::make_pair(nodes[current].right, depth + 1));
+            }
+        }
+        std::vector<node_index> roots;
+        van_emde_boas_layout(root, height, order, roots, stack);
+    } else {
+        in_order_layout(order);
+    }
+
+    std::vector<node_index> new_index(nodes.size(), 0);
+    for (node_index i = 0; i < order.size(); ++i) {
+        new_index[order[i]] = i;
+    }
+    std::vector<node> fresh;
+    fresh.reserve(order.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        fresh.push_back(nodes[order[i]]);
+        node &current = fresh.back();
+        current.left = new_index[current.left];
+        current.right = new_index[current.right];
+        current.parent = new_index[current.parent];
+    }
+    nodes.swap(fresh);
+    root = new_index[root];
+
+    for (typename std::unordered_map<T, node_index>::iterator it = value_index.begin();
+        it != value_index.end();
+        ++it) {
+        it->second = new_index[it->second];
+    }
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::set_compact_period(const int period, const bool van_emde_boas) {
+    compact_period = period;
+    compact_van_emde_boas = van_emde_boas;
+    changes_count = 0;
+}
+
+template <typename T, typename Aggregate>
+std::string basic_treap<T, Aggregate>::get_description(const std::string separator) {
+    std::ostringstream description;
+    output_writer writer(description);
+    bool first = true;
+    for_each([&writer, &separator, &first](const T &value) {
+        if (!first) {
+            writer.write_string(separator);
+        }
+        write_value(writer, value, formatted_tag<T>());
+        first = false;
+    });
+    writer.flush();
+    return description.str();
+}
+
+template <typename T, typename Aggregate>
+template <typename Function>
+void basic_treap<T, Aggregate>::for_each(Function function) {
+    node_index current = root;
+    std::vector<node_index> stack;
+    while (current || !stack.empty()) {
+        while (current) {
+            push(current);
+            stack.push_back(current);
+            current = nodes[current].left;
+        }
+        current = stack.back();
+        stack.pop_back();
+        function(nodes[current].value);
+        current = nodes[current].right;
+    }
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::depth_statistics basic_treap<T, Aggregate>::depth_stats() {
+    depth_statistics statistics;
+    statistics.max_depth = 0;
+    statistics.average_depth = 0;
+    if (!root) {
+        return statistics;
+    }
+    long long total_depth = 0;
+    depth_stats(root, statistics.max_depth, total_depth);
+    statistics.average_depth = static_cast<double>(total_depth) / size(root);
+    return statistics;
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::save(const std::string &path) {
+    static_assert(
+        std::is_trivially_copyable<node>::value,
+        "snapshot needs trivially copyable elements");
+
+    snapshot_header header = {};
+    std::copy(snapshot_magic(), snapshot_magic() + sizeof(header.magic), header.magic);
+    header.node_size = sizeof(node);
+    header.nodes_count = static_cast<std::uint32_t>(nodes.size());
+    header.root = root;
+    header.value_size = sizeof(T);
+    header.priority_state = priority_state;
+    header.type_tag = snapshot_type_tag();
+
+    std::ofstream output(path.c_str(), std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    output.write(
+        reinterpret_cast<const char *>(nodes.data()),
+        static_cast<std::streamsize>(nodes.size() * sizeof(node)));
+    output.close();
+    if (!output) {
+        throw std::runtime_error("cannot write snapshot " + path);
+    }
+}
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate> basic_treap<T, Aggregate>::load(const std::string &path) {
+    static_assert(
+        std::is_trivially_copyable<node>::value,
+        "snapshot needs trivially copyable elements");
+
+    const mapped_file file(path);
+    snapshot_header header;
+    if (file.size() < sizeof(header)) {
+        throw std::runtime_error("snapshot " + path + " is too short");
+    }
+    std::copy(file.data(), file.data() + sizeof(header), reinterpret_cast<char *>(&header));
+    if (!std::equal(header.magic, header.magic + sizeof(header.magic), snapshot_magic())
+        || header.node_size != sizeof(node)
+        || header.value_size != sizeof(T)
+        || header.type_tag != snapshot_type_tag()
+        || header.nodes_count == 0
+        || header.root >= header.nodes_count
+        || file.size() != sizeof(header) + std::size_t(header.nodes_count) * sizeof(node)) {
+        throw std::runtime_error("file " + path + " is not a snapshot of this treap");
+    }
+
+    basic_treap result(0, header.priority_state);
+    const node *first = reinterpret_cast<const node *>(file.data() + sizeof(header));
+    result.nodes.assign(first, first + header.nodes_count);
+    result.root = header.root;
+    for (std::uint32_t i = 0; i < header.nodes_count; ++i) {
+        const node &current = result.nodes[i];
+        if (current.left >= header.nodes_count
+            || current.right >= header.nodes_count
+            || current.parent >= header.nodes_count) {
+            throw std::runtime_error("snapshot " + path + " has links outside the pool");
+        }
+    }
+    return result;
+}
+
+template <typename T, typename Aggregate>
+const char *basic_treap<T, Aggregate>::snapshot_magic() {
+    return "TREAPSN2";
+}
+
+template <typename T, typename Aggregate>
+std::uint64_t basic_treap<T, Aggregate>::snapshot_type_tag() {
+    std::uint64_t tag = 0xcbf29ce484222325ULL;
+    for (const char *name = typeid(basic_treap).name(); *name; ++name) {
+        tag = (tag ^ static_cast<unsigned char>(*name)) * 0x100000001b3ULL;
+    }
+    return tag;
+}
+
+template <typename T, typename Aggregate>
+int basic_treap<T, Aggregate>::position_of(const T &value) {
+    if (value_index.empty()) {
+        for (node_index i = 1; i < nodes.size(); ++i) {
+            value_index.insert(std::make_pair(nodes[i].value, i));
+        }
+    }
+    const typename std::unordered_map<T, node_index>::const_iterator found =
+        value_index.find(value);
+    if (found == value_index.end()) {
+        return 0;
+    }
+
+    // Lazy reversals above the node decide which child is the left one,
+    // so they are pushed from the root down to the node first.
+    path.clear();
+    for (node_index current = found->second; current; current = nodes[current].parent) {
+        path.push_back(current);
+    }
+    for (int i = static_cast<int>(path.size()) - 1; i >= 0; --i) {
+        push(path[i]);
+    }
+    path.clear();
+
+    node_index current = found->second;
+    int position = size(nodes[current].left) + 1;
+    for (node_index parent = nodes[current].parent; parent; parent = nodes[parent].parent) {
+        if (nodes[parent].right == current) {
+            position += size(nodes[parent].left) + 1;
+        }
+        current = parent;
+    }
+    return position;
+}
+
+template <typename T, typename Aggregate>
+T basic_treap<T, Aggregate>::at(const int position) {
+    if (position < 1 || position > size(root)) {
+        throw std::out_of_range("position is out of the array");
+    }
+    node_index current = root;
+    int remaining = position - 1;
+    while (true) {
+        push(current);
+        const int left_size = size(nodes[current].left);
+        if (remaining < left_size) {
+            current = nodes[current].left;
+        } else if (remaining == left_size) {
+            return nodes[current].value;
+        } else {
+            remaining -= left_size + 1;
+            current = nodes[current].right;
+        }
+    }
+}
+
+template <typename T, typename Aggregate>
+std::vector<T> basic_treap<T, Aggregate>::get_range(const int left, const int right) {
+    if (left < 1 || right > size(root) || left > right + 1) {
+        throw std::out_of_range("subsegment is out of the array");
+    }
+    std::vector<T> result;
+    result.reserve(right - left + 1);
+    iterator current = iterator_at(left);
+    for (int i = left; i <= right; ++i, ++current) {
+        result.push_back(*current);
+    }
+    return result;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator basic_treap<T, Aggregate>::iterator_at(
+    const int position) {
+
+    return iterator(this, position < 1 ? 1 : position);
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator basic_treap<T, Aggregate>::begin() {
+    return iterator(this, 1);
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator basic_treap<T, Aggregate>::end() {
+    return iterator();
+}
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate>::iterator::iterator() : tree(nullptr) {}
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate>::iterator::iterator(basic_treap *tree, const int position)
+    : tree(tree) {
+
+    node_index current = tree->root;
+    int remaining = position - 1;
+    while (current) {
+        tree->push(current);
+        const int left_size = tree->size(tree->nodes[current].left);
+        if (remaining < left_size) {
+            stack.push_back(current);
+            current = tree->nodes[current].left;
+        } else if (remaining == left_size) {
+            stack.push_back(current);
+            break;
+        } else {
+            remaining -= left_size + 1;
+            current = tree->nodes[current].right;
+        }
+    }
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator::reference
+basic_treap<T, Aggregate>::iterator::operator*() const {
+    return tree->nodes[stack.back()].value;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator::pointer
+basic_treap<T, Aggregate>::iterator::operator->() const {
+    return &tree->nodes[stack.back()].value;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator &basic_treap<T, Aggregate>::iterator::operator++() {
+    // Next element is the leftmost node of the right subtree or the nearest ancestor
+    // that is already on the stack.
+    node_index current = tree->nodes[stack.back()].right;
+    stack.pop_back();
+    while (current) {
+        tree->push(current);
+        stack.push_back(current);
+        current = tree->nodes[current].left;
+    }
+    return *this;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::iterator basic_treap<T, Aggregate>::iterator::operator++(int) {
+    iterator previous = *this;
+    ++*this;
+    return previous;
+}
+
+template <typename T, typename Aggregate>
+bool basic_treap<T, Aggregate>::iterator::operator==(const iterator &other) const {
+    if (stack.empty() || other.stack.empty()) {
+        return stack.empty() && other.stack.empty();
+    }
+    return tree == other.tree && stack.back() == other.stack.back();
+}
+
+template <typename T, typename Aggregate>
+bool basic_treap<T, Aggregate>::iterator::operator!=(const iterator &other) const {
+    return !(*this == other);
+}
+
+template <typename T, typename Aggregate>
+typename Aggregate::result_type basic_treap<T, Aggregate>::get_aggregate(
+    const int left,
+    const int right) {
+
+    node_index before_left, after_left;
+    split(root, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    const typename Aggregate::result_type result = nodes[between_left_and_right].summary;
+
+    node_index temp;
+    merge(before_left, between_left_and_right, temp);
+    merge(temp, after_right, root);
+
+    return result;
+}
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate>::node::node()
+    : value(),
+    size(0),
+    priority(0),
+    reversed(0),
+    left(0),
+    right(0),
+    parent(0) {
+}
+
+template <typename T, typename Aggregate>
+basic_treap<T, Aggregate>::node::node(const T &value, const std::uint32_t priority)
+    : value(value),
+    size(1),
+    priority(priority),
+    reversed(0),
+    left(0),
+    right(0),
+    parent(0) {
+}
+
+template <typename T, typename Aggregate>
+std::uint32_t basic_treap<T, Aggregate>::next_priority() {
+    return hash_priority(priority_state += priority_step);
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::create_node(
+    const T &value) {
+
+    nodes.push_back(node(value, next_priority()));
+    const node_index index = static_cast<node_index>(nodes.size() - 1);
+    update(index);
+    return index;
+}
+
+template <typename T, typename Aggregate>
+int basic_treap<T, Aggregate>::size(node_index root) {
+    return nodes[root].size;
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::count_change() {
+    if (compact_period > 0 && ++changes_count >= compact_period) {
+        compact(compact_van_emde_boas);
+    }
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::in_order_layout(std::vector<node_index> &order) {
+    std::vector<node_index> stack;
+    node_index current = root;
+    while (current || !stack.empty()) {
+        while (current) {
+            push(current);
+            stack.push_back(current);
+            current = nodes[current].left;
+        }
+        current = stack.back();
+        stack.pop_back();
+        order.push_back(current);
+        current = nodes[current].right;
+    }
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::van_emde_boas_layout(
+    node_index root,
+    const int height,
+    std::vector<node_index> &order,
+    std::vector<node_index> &roots,
+    std::vector<std::pair<node_index, int> > &stack) {
+
+    if (!root) {
+        return;
+    }
+    if (height == 1) {
+        order.push_back(root);
+        return;
+    }
+
+    const int top_height = height / 2;
+    van_emde_boas_layout(root, top_height, order, roots, stack);
+
+    // Roots of the bottom subtrees are the nodes right below the top part, from left to right.
+    const std::size_t first = roots.size();
+    stack.push_back(std::make_pair(root, 1));
+    while (!stack.empty()) {
+        const node_index current = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        if (depth > top_height) {
+            roots.push_back(current);
+            continue;
+        }
+        if (nodes[current].right) {
+            stack.push_back(std::make_pair(nodes[current].right, depth + 1));
+        }
+        if (nodes[current].left) {
+            stack.push_back(std::make_pair(nodes[current].left, depth + 1));
+        }
+    }
+    const std::size_t last = roots.size();
+    for (std::size_t i = first; i < last; ++i) {
+        van_emde_boas_layout(roots[i], height - top_height, order, roots, stack);
+    }
+    roots.resize(first);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::push(node_index root) {
+    node &current = nodes[root];
+    if (!current.reversed) {
+        return;
+    }
+    std::swap(current.left, current.right);
+    if (current.left) {
+        nodes[current.left].reversed ^= 1;
+    }
+    if (current.right) {
+        nodes[current.right].reversed ^= 1;
+    }
+    current.reversed = 0;
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::update(node_index root) {
+    if (!root) {
+        return;
+    }
+    nodes[root].size = 1 + size(nodes[root].left) + size(nodes[root].right);
+    update_summary(root, aggregate_tag());
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::update_summary(node_index root, std::true_type) {
+    const node &current = nodes[root];
+    nodes[root].summary = Aggregate::combine(
+        Aggregate::combine(nodes[current.left].summary, Aggregate::lift(current.value)),
+        nodes[current.right].summary);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::update_summary(node_index, std::false_type) {}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::join_summary(
+    node_index root,
+    node_index left,
+    node_index right,
+    std::true_type) {
+
+    nodes[root].summary = Aggregate::combine(nodes[left].summary, nodes[right].summary);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::join_summary(
+    node_index,
+    node_index,
+    node_index,
+    std::false_type) {
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::update_path(std::true_type) {
+    for (int i = static_cast<int>(path.size()) - 1; i >= 0; --i) {
+        update_summary(path[i], aggregate_tag());
+    }
+    path.clear();
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::update_path(std::false_type) {}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::merge(
+    node_index left,
+    node_index right,
+    node_index &result) {
+
+    node_index *slot = &result;
+    node_index owner = 0;
+    TREAP_DECLARE_COUNTER(visited);
+    while (left && right) {
+        TREAP_COUNT_VISIT(visited);
+        if (nodes[left].priority > nodes[right].priority) {
+            // Whole right treap goes to the end of the subtree of the left node.
+            push(left);
+            nodes[left].size += nodes[right].size;
+            join_summary(left, left, right, aggregate_tag());
+            *slot = left;
+            nodes[left].parent = owner;
+            owner = left;
+            slot = &nodes[left].right;
+            left = nodes[left].right;
+        } else {
+            // Whole left treap goes to the start of the subtree of the right node.
+            push(right);
+            nodes[right].size += nodes[left].size;
+            join_summary(right, left, right, aggregate_tag());
+            *slot = right;
+            nodes[right].parent = owner;
+            owner = right;
+            slot = &nodes[right].left;
+            right = nodes[right].left;
+        }
+    }
+    *slot = left ? left : right;
+    if (*slot) {
+        nodes[*slot].parent = owner;
+    }
+    TREAP_RECORD_MERGE(visited);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::split(
+    node_index root,
+    node_index &left,
+    node_index &right,
+    const int position) {
+
+    split_to(root, &left, 0, &right, 0, position);
+    update_path(aggregate_tag());
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::split_to(
+    node_index root,
+    node_index *left_slot,
+    node_index left_owner,
+    node_index *right_slot,
+    node_index right_owner,
+    const int position) {
+
+    int remaining = position;
+    TREAP_DECLARE_COUNTER(visited);
+    while (root) {
+        TREAP_COUNT_VISIT(visited);
+        if (aggregate_tag::value) {
+            path.push_back(root);
+        }
+        push(root);
+        node &current = nodes[root];
+        const int left_size = size(current.left);
+        if (remaining <= left_size) {
+            // Node goes to the right treap and loses first elements of its left child.
+            current.size -= remaining;
+            *right_slot = root;
+            current.parent = right_owner;
+            right_owner = root;
+            right_slot = &current.left;
+            root = current.left;
+        } else {
+            // Node goes to the left treap and keeps only first elements of its subtree.
+            if (remaining < current.size) {
+                current.size = remaining;
+            }
+            remaining -= left_size + 1;
+            *left_slot = root;
+            current.parent = left_owner;
+            left_owner = root;
+            left_slot = &current.right;
+            root = current.right;
+        }
+    }
+    *left_slot = *right_slot = 0;
+    TREAP_RECORD_SPLIT(visited);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::split_many(
+    node_index root,
+    const std::vector<int> &cuts,
+    std::vector<node_index> &pieces) {
+
+    const int pieces_count = static_cast<int>(cuts.size()) + 1;
+    const int count = size(root);
+    pieces.assign(pieces_count, 0);
+
+    // Like in split, every piece has the place for its next node and the owner of the place.
+    std::vector<node_index *> &slots = cut_slots;
+    std::vector<node_index> &owners = cut_owners;
+    slots.resize(pieces_count);
+    owners.assign(pieces_count, 0);
+    for (int i = 0; i < pieces_count; ++i) {
+        slots[i] = &pieces[i];
+    }
+
+    std::vector<cut_frame> &stack = cut_stack;
+    const cut_frame whole = { root, 0, 0, pieces_count - 1, 0 };
+    stack.push_back(whole);
+    TREAP_DECLARE_COUNTER(visited);
+    while (!stack.empty()) {
+        cut_frame current = stack.back();
+        stack.pop_back();
+        if (current.parent) {
+            // First piece of the right subtree continues under its parent.
+            slots[current.first] = &nodes[current.parent].right;
+            owners[current.first] = current.parent;
+        }
+        while (current.root) {
+            if (current.first == current.last) {
+                // Whole subtree belongs to one piece.
+                *slots[current.first] = current.root;
+                nodes[current.root].parent = owners[current.first];
+                break;
+            }
+            if (current.first + 1 == current.last) {
+                // Only one cut is left, the rest of the way is the ordinary split.
+                split_to(
+                    current.root,
+                    slots[current.first],
+                    owners[current.first],
+                    slots[current.last],
+                    owners[current.last],
+                    cuts[current.first] - current.offset);
+                break;
+            }
+            TREAP_COUNT_VISIT(visited);
+            if (aggregate_tag::value) {
+                path.push_back(current.root);
+            }
+            push(current.root);
+            node &parent = nodes[current.root];
+            const int left_size = size(parent.left);
+
+            // Cuts up to the end of the left subtree go to it, the rest go to the right one,
+            // so the node belongs to the piece after the cuts of the left subtree.
+            const int piece = static_cast<int>(std::upper_bound(
+                cuts.begin() + current.first,
+                cuts.begin() + current.last,
+                current.offset + left_size) - cuts.begin());
+            const int piece_begin = piece > 0 ? cuts[piece - 1] : 0;
+            const int piece_end = piece < pieces_count - 1 ? cuts[piece] : count;
+            const int subtree_end = current.offset + parent.size;
+            parent.size = (subtree_end < piece_end ? subtree_end : piece_end)
+                - (current.offset > piece_begin ? current.offset : piece_begin);
+
+            *slots[piece] = current.root;
+            parent.parent = owners[piece];
+            // Child without cuts stays in the piece of the node as it is.
+            if (piece != current.last) {
+                const cut_frame right = {
+                    parent.right,
+                    current.offset + left_size + 1,
+                    piece,
+                    current.last,
+                    current.root
+                };
+                stack.push_back(right);
+                parent.right = 0;
+            }
+            if (piece == current.first) {
+                break;
+            }
+            slots[piece] = &parent.left;
+            owners[piece] = current.root;
+            current.root = parent.left;
+            current.last = piece;
+            parent.left = 0;
+        }
+    }
+    update_path(aggregate_tag());
+    TREAP_RECORD_SPLIT(visited);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::insert(
+    node_index &root,
+    node_index item,
+    const int position) {
+
+    node_index before, after;
+    split(root, before, after, position);
+    merge(before, item, before);
+    merge(before, after, root);
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::get_elements(node_index root, T *elements) {
+    std::vector<node_index> stack;
+    while (root || !stack.empty()) {
+        while (root) {
+            push(root);
+            stack.push_back(root);
+            root = nodes[root].left;
+        }
+        root = stack.back();
+        stack.pop_back();
+        *elements++ = nodes[root].value;
+        root = nodes[root].right;
+    }
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::get_tasks(
+    node_index root,
+    T *elements,
+    const int task_size,
+    std::vector<std::pair<node_index, int> > &tasks) {
+
+    std::vector<std::pair<node_index, int> > stack;
+    stack.push_back(std::make_pair(root, 0));
+    while (!stack.empty()) {
+        const node_index current = stack.back().first;
+        const int offset = stack.back().second;
+        stack.pop_back();
+        if (size(current) <= task_size) {
+            if (current) {
+                tasks.push_back(std::make_pair(current, offset));
+            }
+            continue;
+        }
+        push(current);
+        const int position = offset + size(nodes[current].left);
+        elements[position] = nodes[current].value;
+        stack.push_back(std::make_pair(nodes[current].left, offset));
+        stack.push_back(std::make_pair(nodes[current].right, position + 1));
+    }
+}
+
+template <typename T, typename Aggregate>
+std::vector<T> basic_treap<T, Aggregate>::get_elements() {
+    const int count = size(root);
+    std::vector<T> result(count);
+    const int threads_count = std::thread::hardware_concurrency();
+    if (count < parallel_extract_threshold || threads_count <= 1) {
+        get_elements(root, result.data());
+        return result;
+    }
+
+    // Several subtrees per thread, so that threads that finish early take the rest.
+    int task_size = count / (threads_count * 8);
+    if (task_size < extract_task_size) {
+        task_size = extract_task_size;
+    }
+    std::vector<std::pair<node_index, int> > tasks;
+    get_tasks(root, result.data(), task_size, tasks);
+
+    std::atomic<int> next_task(0);
+    auto work = [this, &tasks, &next_task, &result]() {
+        for (int i = next_task++; i < static_cast<int>(tasks.size()); i = next_task++) {
+            get_elements(tasks[i].first, result.data() + tasks[i].second);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < threads_count; ++i) {
+        threads.push_back(std::thread(work));
+    }
+    work();
+    for (std::size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+    return result;
+}
+
+template <typename T, typename Aggregate>
+void basic_treap<T, Aggregate>::depth_stats(
+    node_index root,
+    int &max_depth,
+    long long &total_depth) {
+
+    std::vector<std::pair<node_index, int> > stack;
+    stack.push_back(std::make_pair(root, 1));
+    while (!stack.empty()) {
+        const node_index current = stack.back().first;
+        const int depth = stack.back().second;
+        stack.pop_back();
+        if (depth > max_depth) {
+            max_depth = depth;
+        }
+        total_depth += depth;
+        if (nodes[current].left) {
+            stack.push_back(std::make_pair(nodes[current].left, depth + 1));
+        }
+        if (nodes[current].right) {
+            stack.push_back(std::make_pair(nodes[current].right, depth + 1));
+        }
+    }
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::reorder(
+    node_index root,
+    const int left,
+    const int right) {
+
+    node_index before_left, after_left;
+    split(root, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    node_index temp, result;
+    merge(between_left_and_right, before_left, temp);
+    merge(temp, after_right, result);
+
+    return result;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::reverse(
+    node_index root,
+    const int left,
+    const int right) {
+
+    node_index before_left, after_left;
+    split(root, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    if (between_left_and_right) {
+        nodes[between_left_and_right].reversed ^= 1;
+    }
+
+    node_index temp, result;
+    merge(before_left, between_left_and_right, temp);
+    merge(temp, after_right, result);
+
+    return result;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::move_to(
+    node_index root,
+    const int left,
+    const int right,
+    const int position) {
+
+    node_index before_left, after_left;
+    split(root, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    node_index rest;
+    merge(before_left, after_right, rest);
+
+    node_index before_position, after_position;
+    split(rest, before_position, after_position, position - 1);
+
+    node_index temp, result;
+    merge(before_position, between_left_and_right, temp);
+    merge(temp, after_position, result);
+
+    return result;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::rotate(
+    node_index root,
+    const int left,
+    const int right,
+    const int shift) {
+
+    const int length = right - left + 1;
+    int first_part = length > 0 ? shift % length : 0;
+    if (first_part < 0) {
+        first_part += length;
+    }
+
+    node_index before_left, after_left;
+    split(root, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, length);
+
+    node_index head, tail;
+    split(between_left_and_right, head, tail, first_part);
+
+    node_index temp, result;
+    merge(before_left, tail, temp);
+    merge(temp, head, temp);
+    merge(temp, after_right, result);
+
+    return result;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::build(
+    std::vector<T> &values) {
+
+    const int count = values.size();
+    const node_index first = static_cast<node_index>(nodes.size());
+    const std::uint64_t priority_base = priority_state;
+    nodes.resize(nodes.size() + count);
+    priority_state += priority_step * count;
+
+    int threads_count = std::thread::hardware_concurrency();
+    if (threads_count > count / parallel_build_threshold) {
+        threads_count = count / parallel_build_threshold;
+    }
+    if (threads_count <= 1) {
+        return build_range(values, first, 0, count, priority_base);
+    }
+
+    std::vector<node_index> parts(threads_count);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threads_count; ++i) {
+        const int begin = static_cast<long long>(count) * i / threads_count;
+        const int end = static_cast<long long>(count) * (i + 1) / threads_count;
+        threads.push_back(std::thread(
+            [this, &values, &parts, first, begin, end, priority_base, i]() {
+                parts[i] = build_range(values, first, begin, end, priority_base);
+            }));
+    }
+    node_index result = 0;
+    for (int i = 0; i < threads_count; ++i) {
+        threads[i].join();
+        merge(result, parts[i], result);
+    }
+    return result;
+}
+
+template <typename T, typename Aggregate>
+typename basic_treap<T, Aggregate>::node_index basic_treap<T, Aggregate>::build_range(
+    const std::vector<T> &values,
+    const node_index first,
+    const int begin,
+    const int end,
+    const std::uint64_t priority_base) {
+
+    std::vector<node_index> spine;
+    for (int i = begin; i < end; ++i) {
+        const node_index index = first + i;
+        const std::uint64_t key = priority_base + priority_step * (i + 1);
+        nodes[index] = node(values[i], hash_priority(key));
+        node_index last = 0;
+        while (!spine.empty() && nodes[spine.back()].priority < nodes[index].priority) {
+            last = spine.back();
+            spine.pop_back();
+            update(last);
+        }
+        nodes[index].left = last;
+        if (last) {
+            nodes[last].parent = index;
+        }
+        if (!spine.empty()) {
+            nodes[spine.back()].right = index;
+            nodes[index].parent = spine.back();
+        }
+        spine.push_back(index);
+    }
+    // Subtree of the node is complete when the node leaves the spine,
+    // so sizes are updated in the order of removing.
+    for (int i = static_cast<int>(spine.size()) - 1; i >= 0; --i) {
+        update(spine[i]);
+    }
+    return spine.empty() ? 0 : spine[0];
+}
+
+
+template <typename Derived, typename T>
+basic_path_copying_treap<Derived, T>::node::node()
+    : value(),
+    size(0),
+    priority(0),
+    left(0),
+    right(0) {
+}
+
+template <typename Derived, typename T>
+basic_path_copying_treap<Derived, T>::node::node(const T &value, const std::uint32_t priority)
+    : value(value),
+    size(1),
+    priority(priority),
+    left(0),
+    right(0) {
+}
+
+template <typename Derived, typename T>
+typename basic_path_copying_treap<Derived, T>::node_index basic_path_copying_treap<Derived, T>::build(
+    std::vector<T> &values,
+    const std::uint64_t seed) {
+
+    Derived &nodes = storage();
+    const int count = values.size();
+    nodes.allocate();
+
+    std::vector<node_index> spine;
+    for (int i = 0; i < count; ++i) {
+        const std::uint64_t key = seed + priority_step * (i + 1);
+        const node_index index = nodes.allocate();
+        nodes.at(index) = node(values[i], hash_priority(key));
+        node_index last = 0;
+        while (!spine.empty() && nodes.at(spine.back()).priority < nodes.at(index).priority) {
+            last = spine.back();
+            spine.pop_back();
+            node &current = nodes.at(last);
+            current.size = 1 + nodes.at(current.left).size + nodes.at(current.right).size;
+        }
+        nodes.at(index).left = last;
+        if (!spine.empty()) {
+            nodes.at(spine.back()).right = index;
+        }
+        spine.push_back(index);
+    }
+    for (int i = static_cast<int>(spine.size()) - 1; i >= 0; --i) {
+        node &current = nodes.at(spine[i]);
+        current.size = 1 + nodes.at(current.left).size + nodes.at(current.right).size;
+    }
+    return spine.empty() ? 0 : spine[0];
+}
+
+template <typename Derived, typename T>
+void basic_path_copying_treap<Derived, T>::link(
+    node_index owner,
+    const bool to_right,
+    node_index child,
+    node_index &result) {
+
+    if (!owner) {
+        result = child;
+    } else if (to_right) {
+        storage().at(owner).right = child;
+    } else {
+        storage().at(owner).left = child;
+    }
+}
+
+template <typename Derived, typename T>
+void basic_path_copying_treap<Derived, T>::merge(
+    node_index left,
+    node_index right,
+    node_index &result) {
+
+    // Indices are used instead of references, copying may move the pool.
+    Derived &nodes = storage();
+    node_index owner = 0;
+    bool to_right = false;
+    result = 0;
+    while (left && right) {
+        if (nodes.at(left).priority > nodes.at(right).priority) {
+            const node_index current = nodes.own(left);
+            nodes.at(current).size += nodes.at(right).size;
+            link(owner, to_right, current, result);
+            owner = current;
+            to_right = true;
+            left = nodes.at(current).right;
+        } else {
+            const node_index current = nodes.own(right);
+            nodes.at(current).size += nodes.at(left).size;
+            link(owner, to_right, current, result);
+            owner = current;
+            to_right = false;
+            right = nodes.at(current).left;
+        }
+    }
+    link(owner, to_right, left ? left : right, result);
+}
+
+template <typename Derived, typename T>
+void basic_path_copying_treap<Derived, T>::split(
+    node_index root,
+    node_index &left,
+    node_index &right,
+    const int position) {
+
+    Derived &nodes = storage();
+    node_index left_owner = 0;
+    node_index right_owner = 0;
+    left = right = 0;
+    int remaining = position;
+    while (root) {
+        const node_index current = nodes.own(root);
+        const int left_size = nodes.at(nodes.at(current).left).size;
+        if (remaining <= left_size) {
+            nodes.at(current).size -= remaining;
+            link(right_owner, false, current, right);
+            right_owner = current;
+            root = nodes.at(current).left;
+        } else {
+            if (remaining < nodes.at(current).size) {
+                nodes.at(current).size = remaining;
+            }
+            remaining -= left_size + 1;
+            link(left_owner, true, current, left);
+            left_owner = current;
+            root = nodes.at(current).right;
+        }
+    }
+    link(left_owner, true, 0, left);
+    link(right_owner, false, 0, right);
+}
+
+template <typename Derived, typename T>
+Derived &basic_path_copying_treap<Derived, T>::storage() {
+    return static_cast<Derived &>(*this);
+}
+
+template <typename T>
+basic_persistent_treap<T>::basic_persistent_treap(const int size, const std::uint64_t seed) {
+    std::vector<T> values(size);
+    for (int i = 0; i < size; ++i) {
+        values[i] = static_cast<T>(i + 1);
+    }
+    initial_version = build(values, seed);
+}
+
+template <typename T>
+basic_persistent_treap<T>::basic_persistent_treap(
+    std::vector<T> &values,
+    const std::uint64_t seed) {
+
+    initial_version = build(values, seed);
+}
+
+template <typename T>
+typename basic_persistent_treap<T>::version basic_persistent_treap<T>::get_initial_version() {
+    return initial_version;
+}
+
+template <typename T>
+typename basic_persistent_treap<T>::version basic_persistent_treap<T>::reorder(
+    const version source,
+    const int left,
+    const int right) {
+
+    first_own_node = static_cast<node_index>(nodes.size());
+
+    node_index before_left, after_left;
+    split(source, before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    node_index temp, result;
+    merge(between_left_and_right, before_left, temp);
+    merge(temp, after_right, result);
+
+    return result;
+}
+
+template <typename T>
+std::vector<T> basic_persistent_treap<T>::get_elements(const version source) {
+    std::vector<T> result;
+    result.reserve(size(source));
+    std::vector<node_index> stack;
+    node_index root = source;
+    while (root || !stack.empty()) {
+        while (root) {
+            stack.push_back(root);
+            root = nodes[root].left;
+        }
+        root = stack.back();
+        stack.pop_back();
+        result.push_back(nodes[root].value);
+        root = nodes[root].right;
+    }
+    return result;
+}
+
+template <typename T>
+int basic_persistent_treap<T>::size(const version source) {
+    return nodes[source].size;
+}
+
+template <typename T>
+std::size_t basic_persistent_treap<T>::nodes_count() {
+    return nodes.size();
+}
+
+template <typename T>
+void basic_persistent_treap<T>::collect(std::vector<version> &versions) {
+    // New indices are given in the order of visiting, shared nodes are visited once.
+    std::vector<node_index> new_index(nodes.size(), 0);
+    std::vector<node_index> order;
+    std::vector<node_index> stack;
+    // Initial version is kept too, so get_initial_version stays valid.
+    for (std::size_t i = 0; i <= versions.size(); ++i) {
+        stack.push_back(i < versions.size() ? versions[i] : initial_version);
+        while (!stack.empty()) {
+            const node_index current = stack.back();
+            stack.pop_back();
+            if (!current || new_index[current]) {
+                continue;
+            }
+            order.push_back(current);
+            new_index[current] = static_cast<node_index>(order.size());
+            stack.push_back(nodes[current].left);
+            stack.push_back(nodes[current].right);
+        }
+    }
+
+    std::vector<node> collected;
+    collected.reserve(order.size() + 1);
+    collected.push_back(node());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        node copy = nodes[order[i]];
+        copy.left = new_index[copy.left];
+        copy.right = new_index[copy.right];
+        collected.push_back(copy);
+    }
+    nodes.swap(collected);
+
+    for (std::size_t i = 0; i < versions.size(); ++i) {
+        versions[i] = new_index[versions[i]];
+    }
+    initial_version = new_index[initial_version];
+}
+
+template <typename T>
+typename basic_persistent_treap<T>::node &basic_persistent_treap<T>::at(
+    const node_index index) {
+
+    return nodes[index];
+}
+
+template <typename T>
+typename basic_persistent_treap<T>::node_index basic_persistent_treap<T>::allocate() {
+    nodes.push_back(node());
+    return static_cast<node_index>(nodes.size() - 1);
+}
+
+template <typename T>
+typename basic_persistent_treap<T>::node_index basic_persistent_treap<T>::build(
+    std::vector<T> &values,
+    const std::uint64_t seed) {
+
+    nodes.reserve(values.size() + 1);
+    const node_index root = base::build(values, seed);
+    first_own_node = static_cast<node_index>(nodes.size());
+    return root;
+}
+
+template <typename T>
+typename basic_persistent_treap<T>::node_index basic_persistent_treap<T>::own(
+    node_index root) {
+
+    if (root >= first_own_node) {
+        return root;
+    }
+    const node copy = nodes[root];
+    const node_index index = allocate();
+    nodes[index] = copy;
+    return index;
+}
+
+template <typename T>
+basic_concurrent_treap<T>::snapshot::snapshot(basic_concurrent_treap &tree, const int reader)
+    : tree(tree),
+    reader(reader) {
+
+    // Epoch is announced before the root is read, so the writer keeps the nodes
+    // of every version published after the announced epoch started.
+    tree.readers[reader].epoch.store(tree.epoch.load());
+    root = tree.root.load();
+}
+
+template <typename T>
+basic_concurrent_treap<T>::snapshot::~snapshot() {
+    tree.readers[reader].epoch.store(0);
+}
+
+template <typename T>
+int basic_concurrent_treap<T>::snapshot::size() const {
+    return tree.size(root);
+}
+
+template <typename T>
+std::vector<T> basic_concurrent_treap<T>::snapshot::get_elements() const {
+    return get_elements(1, size());
+}
+
+template <typename T>
+std::vector<T> basic_concurrent_treap<T>::snapshot::get_elements(
+    const int left,
+    const int right) const {
+
+    std::vector<T> result;
+    if (left > right) {
+        return result;
+    }
+    result.reserve(right - left + 1);
+
+    // Stack keeps the node at the left position and the ancestors that go after it.
+    std::vector<node_index> stack;
+    node_index current = root;
+    int remaining = left - 1;
+    while (current) {
+        const int left_size = tree.size(tree.at(current).left);
+        if (remaining < left_size) {
+            stack.push_back(current);
+            current = tree.at(current).left;
+        } else if (remaining == left_size) {
+            stack.push_back(current);
+            break;
+        } else {
+            remaining -= left_size + 1;
+            current = tree.at(current).right;
+        }
+    }
+    const std::size_t count = right - left + 1;
+    while (result.size() < count && !stack.empty()) {
+        current = stack.back();
+        stack.pop_back();
+        result.push_back(tree.at(current).value);
+        current = tree.at(current).right;
+        while (current) {
+            stack.push_back(current);
+            current = tree.at(current).left;
+        }
+    }
+    return result;
+}
+
+template <typename T>
+std::string basic_concurrent_treap<T>::snapshot::get_description(
+    const std::string separator) const {
+
+    std::ostringstream description;
+    output_writer writer(description);
+    std::vector<node_index> stack;
+    node_index current = root;
+    bool first = true;
+    while (current || !stack.empty()) {
+        while (current) {
+            stack.push_back(current);
+            current = tree.at(current).left;
+        }
+        current = stack.back();
+        stack.pop_back();
+        if (!first) {
+            writer.write_string(separator);
+        }
+        write_value(writer, tree.at(current).value, formatted_tag<T>());
+        first = false;
+        current = tree.at(current).right;
+    }
+    writer.flush();
+    return description.str();
+}
+
+template <typename T>
+basic_concurrent_treap<T>::basic_concurrent_treap(const int size, const std::uint64_t seed)
+    : chunks(new std::unique_ptr<node[]>[max_chunks]),
+    allocated(0),
+    root(0),
+    epoch(1),
+    readers(new reader_slot[max_readers]()),
+    change(0) {
+
+    std::vector<T> values(size);
+    for (int i = 0; i < size; ++i) {
+        values[i] = static_cast<T>(i + 1);
+    }
+    root.store(build(values, seed));
+}
+
+template <typename T>
+basic_concurrent_treap<T>::basic_concurrent_treap(
+    std::vector<T> &values,
+    const std::uint64_t seed)
+    : chunks(new std::unique_ptr<node[]>[max_chunks]),
+    allocated(0),
+    root(0),
+    epoch(1),
+    readers(new reader_slot[max_readers]()),
+    change(0) {
+
+    root.store(build(values, seed));
+}
+
+template <typename T>
+int basic_concurrent_treap<T>::attach_reader() {
+    for (int i = 0; i < max_readers; ++i) {
+        bool attached = false;
+        if (readers[i].attached.compare_exchange_strong(attached, true)) {
+            return i;
+        }
+    }
+    throw std::runtime_error("too many readers of the concurrent treap");
+}
+
+template <typename T>
+void basic_concurrent_treap<T>::detach_reader(const int reader) {
+    readers[reader].attached.store(false);
+}
+
+template <typename T>
+void basic_concurrent_treap<T>::reorder(const int left, const int right) {
+    ++change;
+
+    node_index before_left, after_left;
+    split(root.load(std::memory_order_relaxed), before_left, after_left, left - 1);
+
+    node_index between_left_and_right, after_right;
+    split(after_left, between_left_and_right, after_right, right - left + 1);
+
+    node_index temp, result;
+    merge(between_left_and_right, before_left, temp);
+    merge(temp, after_right, result);
+
+    // Readers that announce the next epoch see the new root,
+    // so replaced nodes are needed only by readers of the current one.
+    root.store(result);
+    const std::uint64_t current_epoch = epoch.fetch_add(1);
+    for (std::size_t i = 0; i < replaced.size(); ++i) {
+        retired_node node;
+        node.epoch = current_epoch;
+        node.index = replaced[i];
+        retired.push_back(node);
+    }
+    replaced.clear();
+    reclaim();
+}
+
+template <typename T>
+std::size_t basic_concurrent_treap<T>::nodes_count() {
+    return allocated;
+}
+
+template <typename T>
+typename basic_concurrent_treap<T>::node &basic_concurrent_treap<T>::at(
+    const node_index index) {
+
+    return chunks[index >> chunk_bits][index & ((1 << chunk_bits) - 1)];
+}
+
+template <typename T>
+const typename basic_concurrent_treap<T>::node &basic_concurrent_treap<T>::at(
+    const node_index index) const {
+
+    return chunks[index >> chunk_bits][index & ((1 << chunk_bits) - 1)];
+}
+
+template <typename T>
+int basic_concurrent_treap<T>::size(const node_index index) const {
+    return at(index).size;
+}
+
+template <typename T>
+typename basic_concurrent_treap<T>::node_index basic_concurrent_treap<T>::allocate() {
+    node_index index;
+    if (!free_nodes.empty()) {
+        index = free_nodes.back();
+        free_nodes.pop_back();
+    } else {
+        if (allocated == static_cast<std::size_t>(max_chunks) << chunk_bits) {
+            throw std::length_error("concurrent treap is full");
+        }
+        index = static_cast<node_index>(allocated++);
+        if (!chunks[index >> chunk_bits]) {
+            chunks[index >> chunk_bits].reset(new node[1 << chunk_bits]);
+        }
+        owner.push_back(0);
+    }
+    owner[index] = change;
+    return index;
+}
+
+template <typename T>
+typename basic_concurrent_treap<T>::node_index basic_concurrent_treap<T>::build(
+    std::vector<T> &values,
+    const std::uint64_t seed) {
+
+    owner.reserve(values.size() + 1);
+    return base::build(values, seed);
+}
+
+template <typename T>
+typename basic_concurrent_treap<T>::node_index basic_concurrent_treap<T>::own(
+    node_index index) {
+
+    if (owner[index] == change) {
+        return index;
+    }
+    const node_index copy = allocate();
+    at(copy) = at(index);
+    replaced.push_back(index);
+    return copy;
+}
+
+template <typename T>
+void basic_concurrent_treap<T>::reclaim() {
+    std::uint64_t oldest = epoch.load();
+    for (int i = 0; i < max_readers; ++i) {
+        const std::uint64_t reader_epoch = readers[i].epoch.load();
+        if (reader_epoch != 0 && reader_epoch < oldest) {
+            oldest = reader_epoch;
+        }
+    }
+    while (!retired.empty() && retired.front().epoch < oldest) {
+        free_nodes.push_back(retired.front().index);
+        retired.pop_front();
+    }
+}
+
+template <typename T>
+basic_bplus_tree<T>::basic_bplus_tree(const int size) {
+    std::vector<T> values(size);
+    for (int i = 0; i < size; ++i) {
+        values[i] = static_cast<T>(i + 1);
+    }
+    build(values);
+}
+
+template <typename T>
+basic_bplus_tree<T>::basic_bplus_tree(std::vector<T> &values) {
+    build(values);
+}
+
+template <typename T>
+void basic_bplus_tree<T>::reorder(const int left, const int right) {
+    part before_left, after_left;
+    split(tree, left - 1, before_left, after_left);
+
+    part between_left_and_right, after_right;
+    split(after_left, right - left + 1, between_left_and_right, after_right);
+
+    tree = join(join(between_left_and_right, before_left), after_right);
+
+    // Root with one child is dropped, so the height does not grow.
+    while (tree.height > 0 && inners[tree.root].count == 1) {
+        free_inners.push_back(tree.root);
+        tree.root = inners[tree.root].children[0];
+        --tree.height;
+    }
+}
+
+template <typename T>
+std::vector<T> basic_bplus_tree<T>::get_elements() {
+    std::vector<T> result(tree.size);
+    T *elements = result.data();
+    if (tree.size) {
+        get_elements(tree.root, tree.height, elements);
+    }
+    return result;
+}
+
+template <typename T>
+template <typename Function>
+void basic_bplus_tree<T>::for_each(Function function) {
+    if (tree.size) {
+        for_each(tree.root, tree.height, function);
+    }
+}
+
+template <typename T>
+int basic_bplus_tree<T>::size() {
+    return tree.size;
+}
+
+template <typename T>
+int basic_bplus_tree<T>::height() {
+    return tree.height;
+}
+
+template <typename T>
+typename basic_bplus_tree<T>::node_index basic_bplus_tree<T>::allocate_leaf() {
+    if (!free_leaves.empty()) {
+        const node_index index = free_leaves.back();
+        free_leaves.pop_back();
+        return index;
+    }
+    leaves.push_back(leaf());
+    return static_cast<node_index>(leaves.size() - 1);
+}
+
+template <typename T>
+typename basic_bplus_tree<T>::node_index basic_bplus_tree<T>::allocate_inner() {
+    if (!free_inners.empty()) {
+        const node_index index = free_inners.back();
+        free_inners.pop_back();
+        return index;
+    }
+    inners.push_back(inner());
+    return static_cast<node_index>(inners.size() - 1);
+}
+
+template <typename T>
+int basic_bplus_tree<T>::node_size(const node_index index, const int height) {
+    if (height == 0) {
+        return leaves[index].count;
+    }
+    const inner &node = inners[index];
+    int result = 0;
+    for (int i = 0; i < node.count; ++i) {
+        result += node.sizes[i];
+    }
+    return result;
+}
+
+template <typename T>
+void basic_bplus_tree<T>::build(std::vector<T> &values) {
+    const int count = values.size();
+    leaves.resize(1);
+    inners.resize(1);
+    tree.root = 0;
+    tree.height = 0;
+    tree.size = count;
+    if (count == 0) {
+        return;
+    }
+
+    // Elements are spread evenly, so every node is at least half full.
+    const int leaves_count = (count + leaf_capacity - 1) / leaf_capacity;
+    leaves.reserve(leaves_count + 1);
+    std::vector<node_index> level(leaves_count);
+    std::vector<int> level_sizes(leaves_count);
+    for (int i = 0; i < leaves_count; ++i) {
+        const int begin = static_cast<long long>(count) * i / leaves_count;
+        const int end = static_cast<long long>(count) * (i + 1) / leaves_count;
+        level[i] = allocate_leaf();
+        leaves[level[i]].count = end - begin;
+        std::memcpy(leaves[level[i]].values, values.data() + begin, (end - begin) * sizeof(T));
+        level_sizes[i] = end - begin;
+    }
+
+    while (level.size() > 1) {
+        const int children_count = level.size();
+        const int nodes_count = (children_count + inner_capacity - 1) / inner_capacity;
+        std::vector<node_index> next_level(nodes_count);
+        std::vector<int> next_sizes(nodes_count, 0);
+        for (int i = 0; i < nodes_count; ++i) {
+            const int begin = static_cast<long long>(children_count) * i / nodes_count;
+            const int end = static_cast<long long>(children_count) * (i + 1) / nodes_count;
+            next_level[i] = allocate_inner();
+            inner &node = inners[next_level[i]];
+            node.count = end - begin;
+            for (int j = begin; j < end; ++j) {
+                node.children[j - begin] = level[j];
+                node.sizes[j - begin] = level_sizes[j];
+                next_sizes[i] += level_sizes[j];
+            }
+        }
+        level.swap(next_level);
+        level_sizes.swap(next_sizes);
+        ++tree.height;
+    }
+    tree.root = level[0];
+}
+
+template <typename T>
+void basic_bplus_tree<T>::split(
+    const part source,
+    const int position,
+    part &left,
+    part &right) {
+
+    const part empty = { 0, 0, 0 };
+    if (position <= 0 || position >= source.size) {
+        left = position <= 0 ? empty : source;
+        right = position <= 0 ? source : empty;
+        return;
+    }
+
+    // Going down, every node is cut into children before the path and after it,
+    // both groups become separate trees that are joined back going up.
+    left_parts.clear();
+    right_parts.clear();
+    node_index current = source.root;
+    int height = source.height;
+    int remaining = position;
+    while (height > 0) {
+        const node_index right_node = allocate_inner();
+        inner &node = inners[current];
+        int child = 0;
+        int left_size = 0;
+        while (remaining >= node.sizes[child]) {
+            remaining -= node.sizes[child];
+            left_size += node.sizes[child];
+            ++child;
+        }
+        const node_index next = node.children[child];
+
+        inner &after = inners[right_node];
+        after.count = node.count - child - 1;
+        std::memcpy(after.children, node.children + child + 1, after.count * sizeof(node_index));
+        std::memcpy(after.sizes, node.sizes + child + 1, after.count * sizeof(int));
+        node.count = child;
+
+        if (node.count) {
+            const part before_part = { current, height, left_size };
+            left_parts.push_back(before_part);
+        } else {
+            free_inners.push_back(current);
+        }
+        if (after.count) {
+            const part after_part = { right_node, height, node_size(right_node, height) };
+            right_parts.push_back(after_part);
+        } else {
+            free_inners.push_back(right_node);
+        }
+        current = next;
+        --height;
+    }
+
+    part left_result = empty;
+    part right_result = empty;
+    const node_index right_leaf = allocate_leaf();
+    leaf &node = leaves[current];
+    leaf &after = leaves[right_leaf];
+    after.count = node.count - remaining;
+    std::memcpy(after.values, node.values + remaining, after.count * sizeof(T));
+    node.count = remaining;
+    if (node.count) {
+        left_result.root = current;
+        left_result.size = node.count;
+    } else {
+        free_leaves.push_back(current);
+    }
+    if (after.count) {
+        right_result.root = right_leaf;
+        right_result.size = after.count;
+    } else {
+        free_leaves.push_back(right_leaf);
+    }
+
+    // Parts are joined from the lowest one, so every join goes down only a few levels.
+    for (int i = static_cast<int>(left_parts.size()) - 1; i >= 0; --i) {
+        left_result = join(left_parts[i], left_result);
+    }
+    for (int i = static_cast<int>(right_parts.size()) - 1; i >= 0; --i) {
+        right_result = join(right_result, right_parts[i]);
+    }
+    left = left_result;
+    right = right_result;
+}
+
+template <typename T>
+typename basic_bplus_tree<T>::part basic_bplus_tree<T>::join(part left, part right) {
+    if (!left.size) {
+        return right;
+    }
+    if (!right.size) {
+        return left;
+    }
+
+    // Lower tree is attached to the side of the higher one at the node of the same height.
+    const bool into_left = left.height >= right.height;
+    const part &higher = into_left ? left : right;
+    const part &lower = into_left ? right : left;
+    path.clear();
+    node_index current = higher.root;
+    int height = higher.height;
+    while (height > lower.height) {
+        path.push_back(current);
+        const inner &node = inners[current];
+        current = node.children[into_left ? node.count - 1 : 0];
+        --height;
+    }
+
+    node_index replaced = into_left ? current : lower.root;
+    node_index extra = into_left
+        ? combine(current, lower.root, height)
+        : combine(lower.root, current, height);
+    for (int i = static_cast<int>(path.size()) - 1; i >= 0; --i) {
+        const node_index parent = path[i];
+        const int position = into_left ? inners[parent].count - 1 : 0;
+        inners[parent].children[position] = replaced;
+        inners[parent].sizes[position] = node_size(replaced, height);
+        if (extra) {
+            extra = insert_child(parent, position + 1, extra, node_size(extra, height));
+        }
+        replaced = parent;
+        ++height;
+    }
+
+    part result = { replaced, height, left.size + right.size };
+    if (extra) {
+        const node_index root = allocate_inner();
+        inner &node = inners[root];
+        node.count = 2;
+        node.children[0] = replaced;
+        node.children[1] = extra;
+        node.sizes[0] = node_size(replaced, height);
+        node.sizes[1] = node_size(extra, height);
+        result.root = root;
+        result.height = height + 1;
+    }
+    return result;
+}
+
+template <typename T>
+typename basic_bplus_tree<T>::node_index basic_bplus_tree<T>::combine(
+    const node_index left,
+    const node_index right,
+    const int height) {
+
+    if (height == 0) {
+        leaf &first = leaves[left];
+        leaf &second = leaves[right];
+        if (first.count + second.count <= leaf_capacity) {
+            std::memcpy(first.values + first.count, second.values, second.count * sizeof(T));
+            first.count += second.count;
+            free_leaves.push_back(right);
+            return 0;
+        }
+        const int target = (first.count + second.count) / 2;
+        if (first.count > target) {
+            const int moved = first.count - target;
+            std::memmove(second.values + moved, second.values, second.count * sizeof(T));
+            std::memcpy(second.values, first.values + target, moved * sizeof(T));
+            first.count -= moved;
+            second.count += moved;
+        } else {
+            const int moved = target - first.count;
+            std::memcpy(first.values + first.count, second.values, moved * sizeof(T));
+            std::memmove(second.values, second.values + moved, (second.count - moved) * sizeof(T));
+            first.count += moved;
+            second.count -= moved;
+        }
+        return right;
+    }
+
+    inner &first = inners[left];
+    inner &second = inners[right];
+    if (first.count + second.count <= inner_capacity) {
+        std::memcpy(first.children + first.count, second.children, second.count * sizeof(node_index));
+        std::memcpy(first.sizes + first.count, second.sizes, second.count * sizeof(int));
+        first.count += second.count;
+        free_inners.push_back(right);
+        return 0;
+    }
+    const int target = (first.count + second.count) / 2;
+    if (first.count > target) {
+        const int moved = first.count - target;
+        std::memmove(second.children + moved, second.children, second.count * sizeof(node_index));
+        std::memmove(second.sizes + moved, second.sizes, second.count * sizeof(int));
+        std::memcpy(second.children, first.children + target, moved * sizeof(node_index));
+        std::memcpy(second.sizes, first.sizes + target, moved * sizeof(int));
+        first.count -= moved;
+        second.count += moved;
+    } else {
+        const int moved = target - first.count;
+        std::memcpy(first.children + first.count, second.children, moved * sizeof(node_index));
+        std::memcpy(first.sizes + first.count, second.sizes, moved * sizeof(int));
+        std::memmove(
+            second.children,
+            second.children + moved,
+            (second.count - moved) * sizeof(node_index));
+        std::memmove(second.sizes, second.sizes + moved, (second.count - moved) * sizeof(int));
+        first.count += moved;
+        second.count -= moved;
+    }
+    return right;
+}
+
+template <typename T>
+typename basic_bplus_tree<T>::node_index basic_bplus_tree<T>::insert_child(
+    const node_index index,
+    const int position,
+    const node_index child,
+    const int child_size) {
+
+    node_index sibling = 0;
+    if (inners[index].count == inner_capacity) {
+        // Second half goes to the new node before the child is inserted.
+        sibling = allocate_inner();
+        inner &node = inners[index];
+        inner &after = inners[sibling];
+        const int kept = (inner_capacity + 1) / 2;
+        after.count = node.count - kept;
+        std::memcpy(after.children, node.children + kept, after.count * sizeof(node_index));
+        std::memcpy(after.sizes, node.sizes + kept, after.count * sizeof(int));
+        node.count = kept;
+    }
+
+    const bool to_sibling = sibling && position > inners[index].count;
+    inner &target = inners[to_sibling ? sibling : index];
+    const int target_position = to_sibling ? position - inners[index].count : position;
+    std::memmove(
+        target.children + target_position + 1,
+        target.children + target_position,
+        (target.count - target_position) * sizeof(node_index));
+    std::memmove(
+        target.sizes + target_position + 1,
+        target.sizes + target_position,
+        (target.count - target_position) * sizeof(int));
+    target.children[target_position] = child;
+    target.sizes[target_position] = child_size;
+    ++target.count;
+    return sibling;
+}
+
+template <typename T>
+void basic_bplus_tree<T>::get_elements(const node_index index, const int height, T *&elements) {
+    if (height == 0) {
+        std::memcpy(elements, leaves[index].values, leaves[index].count * sizeof(T));
+        elements += leaves[index].count;
+        return;
+    }
+    for (int i = 0; i < inners[index].count; ++i) {
+        get_elements(inners[index].children[i], height - 1, elements);
+    }
+}
+
+template <typename T>
+template <typename Function>
+void basic_bplus_tree<T>::for_each(const node_index index, const int height, Function &function) {
+    if (height == 0) {
+        const leaf &node = leaves[index];
+        for (int i = 0; i < node.count; ++i) {
+            function(node.values[i]);
+        }
+        return;
+    }
+    for (int i = 0; i < inners[index].count; ++i) {
+        for_each(inners[index].children[i], height - 1, function);
+    }
+}
+
+template <typename Function>
+void run_treap::for_each_run(Function function) {
+    node_index current = root;
+    std::vector<node_index> stack;
+    while (current || !stack.empty()) {
+        while (current) {
+            stack.push_back(current);
+            current = nodes[current].left;
+        }
+        current = stack.back();
+        stack.pop_back();
+        function(nodes[current].start, nodes[current].length);
+        current = nodes[current].right;
+    }
+}
+
+template <typename T>
+basic_flat_array<T>::basic_flat_array(const int size) {
+    assign(size);
+}
+
+template <typename T>
+void basic_flat_array<T>::assign(const int size) {
+    elements.resize(size);
+    for (int i = 0; i < size; ++i) {
+        elements[i] = static_cast<T>(i + 1);
+    }
+}
+
+template <typename T>
+void basic_flat_array<T>::reorder(const int left, const int right) {
+    if (left < 1 || left > right || right > static_cast<int>(elements.size())) {
+        return;
+    }
+    // std::rotate swaps elements one by one, plain copies are vectorized.
+    T *data = elements.data();
+    const int before_count = left - 1;
+    const int moved_count = right - left + 1;
+    if (before_count == 0) {
+        return;
+    }
+    if (moved_count <= before_count) {
+        buffer.resize(moved_count);
+        std::memcpy(buffer.data(), data + before_count, moved_count * sizeof(T));
+        std::memmove(data + moved_count, data, before_count * sizeof(T));
+        std::memcpy(data, buffer.data(), moved_count * sizeof(T));
+    } else {
+        buffer.resize(before_count);
+        std::memcpy(buffer.data(), data, before_count * sizeof(T));
+        std::memmove(data, data + before_count, moved_count * sizeof(T));
+        std::memcpy(data + moved_count, buffer.data(), before_count * sizeof(T));
+    }
+}
+
+template <typename T>
+std::vector<T> basic_flat_array<T>::get_elements() {
+    return elements;
+}
+
+template <typename T>
+template <typename Function>
+void basic_flat_array<T>::for_each(Function function) {
+    for (std::size_t i = 0; i < elements.size(); ++i) {
+        function(elements[i]);
+    }
+}
+
+template <typename T>
+spsc_ring<T>::spsc_ring(const std::size_t capacity)
+    : head(0),
+    tail(0),
+    closed(false),
+    cancelled(false) {
+
+    std::size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    items.resize(size);
+    mask = size - 1;
+}
+
+template <typename T>
+bool spsc_ring<T>::write(const T *items, const std::size_t count) {
+    std::size_t written = 0;
+    std::size_t end = tail.load(std::memory_order_relaxed);
+    while (written < count) {
+        const std::size_t free_count = this->items.size() - (end - head.load(std::memory_order_acquire));
+        if (free_count == 0) {
+            if (cancelled.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            tail.store(end, std::memory_order_release);
+            std::this_thread::yield();
+            continue;
+        }
+        const std::size_t part = free_count < count - written ? free_count : count - written;
+        for (std::size_t i = 0; i < part; ++i) {
+            this->items[(end + i) & mask] = items[written + i];
+        }
+        written += part;
+        end += part;
+    }
+    tail.store(end, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+std::size_t spsc_ring<T>::read(T *items, const std::size_t count) {
+    const std::size_t position = head.load(std::memory_order_relaxed);
+    std::size_t available;
+    while (true) {
+        // Closed flag is read before the counter, so no item written before closing is missed.
+        const bool finished = closed.load(std::memory_order_acquire);
+        available = tail.load(std::memory_order_acquire) - position;
+        if (available != 0 || finished) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    const std::size_t part = available < count ? available : count;
+    for (std::size_t i = 0; i < part; ++i) {
+        items[i] = this->items[(position + i) & mask];
+    }
+    head.store(position + part, std::memory_order_release);
+    return part;
+}
+
+template <typename T>
+void spsc_ring<T>::close() {
+    closed.store(true, std::memory_order_release);
+}
+
+template <typename T>
+void spsc_ring<T>::cancel() {
+    cancelled.store(true, std::memory_order_relaxed);
+}
+
+template <typename T>
+void write_value(output_writer &writer, const T &value, std::true_type) {
+    writer.write_int(static_cast<long long>(value));
+}
+
+template <typename T>
+void write_value(output_writer &writer, const T &value, std::false_type) {
+    writer.write_string(std::to_string(value));
+}
+
+template <typename Engine>
+void query_fuser::push(const long long left, const long long right, Engine &engine) {
+    ++queries_count;
+    pending_query current;
+    current.left = left;
+    current.right = right;
+    if (left >= 1 && left <= right) {
+        long long shift = left - 1;
+        if (!pending.empty()
+            && pending.back().right == right
+            && pending.back().left >= 1
+            && pending.back().left <= right) {
+            shift = (shift + pending.back().left - 1) % right;
+            pending.pop_back();
+        }
+        if (shift == 0) {
+            return;
+        }
+        current.left = shift + 1;
+    }
+    pending.push_back(current);
+    if (pending.size() == static_cast<std::size_t>(max_pending)) {
+        apply(engine, max_pending / 2);
+    }
+}
+
+template <typename Engine>
+void query_fuser::flush(Engine &engine) {
+    apply(engine, pending.size());
+}
+
+template <typename Engine>
+void query_fuser::apply(Engine &engine, const std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        engine.reorder(pending[i].left, pending[i].right);
+    }
+    pending.erase(pending.begin(), pending.begin() + count);
+    applied_count += static_cast<int>(count);
+}